@@ -16,12 +16,33 @@ echo ----------------------------------------
 
 cl %CFLAGS% %INC_DIR% %SOURCES% %OUT_DIR% /link %LNK_DIR% %LIBS% /SUBSYSTEM:CONSOLE
 
+echo ----------------------------------------
+echo Building Target: %TARGET%_bench ...
+echo ----------------------------------------
+
+set BENCH_CFLAGS=/std:c11 /W2 /nologo /O2 /Zi /EHsc
+set BENCH_SOURCES=.\src\bench.c
+set BENCH_OUT_DIR=/Fo.\build\ /Fe.\build\%TARGET%_bench /Fm.\build\
+
+cl %BENCH_CFLAGS% %INC_DIR% %BENCH_SOURCES% %BENCH_OUT_DIR% /link %LNK_DIR% %LIBS% /SUBSYSTEM:CONSOLE
+
+echo ----------------------------------------
+echo Building Target: %TARGET%_packer ...
+echo ----------------------------------------
+
+set PACKER_SOURCES=.\src\packer.c
+set PACKER_OUT_DIR=/Fo.\build\ /Fe.\build\%TARGET%_packer /Fm.\build\
+
+cl %BENCH_CFLAGS% %INC_DIR% %PACKER_SOURCES% %PACKER_OUT_DIR% /link %LNK_DIR% /SUBSYSTEM:CONSOLE
+
 echo ----------------------------------------
 echo Building Shaders ...
 echo ----------------------------------------
 
 D:\VulkanSDK\Bin\glslc.exe res\shaders\shader.vert -o res\shaders\vert.spv
 D:\VulkanSDK\Bin\glslc.exe res\shaders\shader.frag -o res\shaders\frag.spv
+D:\VulkanSDK\Bin\glslc.exe res\shaders\depth.vert -o res\shaders\depth.spv
+D:\VulkanSDK\Bin\glslc.exe res\shaders\cull.comp -o res\shaders\cull.spv
 
 echo ----------------------------------------
 echo Coping res folder ...
@@ -29,3 +50,9 @@ echo ----------------------------------------
 
 xcopy /y .\thirdparty\SDL2\lib\x64\SDL2.dll .\build
 xcopy /y /i /s /e .\res .\build\res
+
+echo ----------------------------------------
+echo Packing res folder ...
+echo ----------------------------------------
+
+.\build\%TARGET%_packer.exe res .\build\res.pack
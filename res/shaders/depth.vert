@@ -0,0 +1,15 @@
+#version 450
+
+// NOTE: Position only version of shader.vert for the depth prepass, the color attributes are
+// never fetched and there is no fragment shader.
+layout(location = 0) in vec2 inPosition;
+
+layout(location = 2) in vec2 inInstanceOffset;
+layout(location = 3) in float inInstanceScale;
+layout(location = 5) in float inInstanceDepth;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = vec4(inPosition * inInstanceScale + inInstanceOffset, inInstanceDepth, 1.0);
+}
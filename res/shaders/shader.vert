@@ -3,9 +3,17 @@
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 
+layout(location = 2) in vec2 inInstanceOffset;
+layout(location = 3) in float inInstanceScale;
+layout(location = 4) in vec3 inInstanceColor;
+layout(location = 5) in float inInstanceDepth;
+
 layout(location = 0) out vec3 fragColor;
 
+// NOTE: Must match depth.vert bit for bit, the scene pass tests EQUAL against the depth prepass.
+invariant gl_Position;
+
 void main() {
-    gl_Position = vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
+    gl_Position = vec4(inPosition * inInstanceScale + inInstanceOffset, inInstanceDepth, 1.0);
+    fragColor = inColor * inInstanceColor;
 }
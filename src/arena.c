@@ -0,0 +1,165 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// NOTE: An arena is either a fixed malloc block or a virtual memory range. Virtual arenas reserve
+// address space up front and only commit pages as arena_push reaches them, so they can grow up to
+// the reserve size and only what is actually used counts towards the process memory.
+
+#define ARENA_COMMIT_GRANULARITY kb(64)
+#define ARENA_HUGE_PAGE_SIZE mb(2)
+
+typedef enum ArenaFlags {
+    ARENA_FLAG_VIRTUAL    = 1 << 0,
+    ARENA_FLAG_HUGE_PAGES = 1 << 1,
+} ArenaFlags;
+
+typedef struct Arena {
+    void *data;
+    size_t used;
+    size_t size;
+    size_t reserved;
+    size_t high_water;
+    unsigned int flags;
+} Arena;
+
+Arena arena_create(size_t size) {
+    Arena arena      = { 0 };
+    arena.data       = malloc(size);
+    arena.used       = 0;
+    arena.size       = size;
+    arena.reserved   = size;
+    arena.high_water = 0;
+    return arena;
+}
+
+Arena arena_create_virtual(size_t reserve_size, unsigned int flags) {
+    Arena arena    = { 0 };
+    arena.flags    = flags | ARENA_FLAG_VIRTUAL;
+    arena.reserved = (reserve_size + (ARENA_HUGE_PAGE_SIZE - 1)) & ~(ARENA_HUGE_PAGE_SIZE - 1);
+
+#if defined(_WIN32)
+    // NOTE: MEM_LARGE_PAGES needs SeLockMemoryPrivilege and can't be committed lazily, so the huge
+    // page hint is ignored on windows.
+    arena.data = VirtualAlloc(NULL, arena.reserved, MEM_RESERVE, PAGE_NOACCESS);
+    if(arena.data == NULL) {
+        printf("Failed to reserve arena memory!\n");
+        exit(1);
+    }
+#else
+    int map_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    arena.data    = mmap(NULL, arena.reserved, PROT_NONE, map_flags, -1, 0);
+    if(arena.data == MAP_FAILED) {
+        printf("Failed to reserve arena memory!\n");
+        exit(1);
+    }
+#if defined(MADV_HUGEPAGE)
+    if(flags & ARENA_FLAG_HUGE_PAGES) {
+        madvise(arena.data, arena.reserved, MADV_HUGEPAGE);
+    }
+#endif
+#endif
+
+    return arena;
+}
+
+static void arena_commit(Arena *arena, size_t total_used) {
+    size_t granularity = (arena->flags & ARENA_FLAG_HUGE_PAGES) ? ARENA_HUGE_PAGE_SIZE
+                                                                : ARENA_COMMIT_GRANULARITY;
+    size_t new_size    = (total_used + (granularity - 1)) & ~(granularity - 1);
+    if(new_size > arena->reserved) {
+        new_size = arena->reserved;
+    }
+    assert(total_used <= new_size);
+
+    void *commit_addr  = (unsigned char *)arena->data + arena->size;
+    size_t commit_size = new_size - arena->size;
+#if defined(_WIN32)
+    if(VirtualAlloc(commit_addr, commit_size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+        printf("Failed to commit arena memory!\n");
+        exit(1);
+    }
+#else
+    if(mprotect(commit_addr, commit_size, PROT_READ | PROT_WRITE) != 0) {
+        printf("Failed to commit arena memory!\n");
+        exit(1);
+    }
+#endif
+    arena->size = new_size;
+}
+
+void *arena_push_no_zero(Arena *arena, size_t size, size_t align) {
+    assert(is_power_of_two(align));
+    uintptr_t unaligned_addr = (uintptr_t)arena->data + arena->used;
+    uintptr_t aligned_addr   = (unaligned_addr + (align - 1)) & ~(align - 1);
+    assert(aligned_addr % align == 0);
+    size_t current_used = (aligned_addr - (uintptr_t)arena->data);
+    size_t total_used   = current_used + size;
+    if(total_used > arena->size && (arena->flags & ARENA_FLAG_VIRTUAL)) {
+        arena_commit(arena, total_used);
+    }
+    assert(total_used <= arena->size);
+    arena->used = total_used;
+    if(arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return (void *)aligned_addr;
+}
+
+void *arena_push(Arena *arena, size_t size, size_t align) {
+    void *result = arena_push_no_zero(arena, size, align);
+    memset(result, 0, size);
+    return result;
+}
+
+// NOTE: Use the _no_zero variants for memory that is completely overwritten right away (file
+// contents, vkEnumerate* results, staging copies), zeroing multi MB blocks is not free.
+#define arena_push_struct(arena, type) ((type *)arena_push((arena), sizeof(type), _Alignof(type)))
+#define arena_push_array(arena, type, count)                                                       \
+    ((type *)arena_push((arena), sizeof(type) * (count), _Alignof(type)))
+#define arena_push_array_no_zero(arena, type, count)                                               \
+    ((type *)arena_push_no_zero((arena), sizeof(type) * (count), _Alignof(type)))
+
+void arena_clear(Arena *arena) {
+    arena->used = 0;
+}
+
+// NOTE: Save/restore markers for nested scratch use. Everything pushed after temp_memory_begin is
+// released by the matching temp_memory_end, markers must be ended in reverse order.
+typedef struct TempMemory {
+    Arena *arena;
+    size_t used;
+} TempMemory;
+
+TempMemory temp_memory_begin(Arena *arena) {
+    TempMemory temp = { 0 };
+    temp.arena      = arena;
+    temp.used       = arena->used;
+    return temp;
+}
+
+void temp_memory_end(TempMemory temp) {
+    assert(temp.arena->used >= temp.used);
+    temp.arena->used = temp.used;
+}
+
+void arena_destroy(Arena *arena) {
+    if(arena->flags & ARENA_FLAG_VIRTUAL) {
+#if defined(_WIN32)
+        VirtualFree(arena->data, 0, MEM_RELEASE);
+#else
+        munmap(arena->data, arena->reserved);
+#endif
+    } else {
+        free(arena->data);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+void arena_print_stats(const char *name, Arena *arena) {
+    printf("arena %-12s used %10zu, high water %10zu, committed %10zu, reserved %12zu\n", name,
+           arena->used, arena->high_water, arena->size, arena->reserved);
+}
@@ -0,0 +1,303 @@
+// NOTE: Asynchronous asset loading. Requests go into a priority queue served by a pool of worker
+// threads, each worker maps the file (and runs the optional process callback for decompression or
+// other CPU side work) and pushes the request into a completion queue. The main thread drains the
+// completion queue once per frame with asset_loader_poll, so I/O overlaps rendering. When a pack
+// is mounted paths are looked up in it first and only missing ones fall back to loose files.
+
+#define ASSET_LOADER_MAX_REQUESTS 1024
+#define ASSET_LOADER_MAX_WORKERS 8
+#define ASSET_PATH_SIZE 256
+
+typedef enum AssetPriority {
+    ASSET_PRIORITY_BACKGROUND = 0,
+    ASSET_PRIORITY_NORMAL     = 1,
+    ASSET_PRIORITY_VISIBLE    = 2,
+} AssetPriority;
+
+struct AssetRequest;
+typedef void (*AssetProcessFunc)(struct AssetRequest *request);
+
+typedef struct AssetRequest {
+    char path[ASSET_PATH_SIZE];
+    AssetPriority priority;
+    unsigned long long sequence;
+
+    // NOTE: Runs on the worker after the file is mapped. It can replace data with its own output,
+    // memory it allocates belongs to the caller.
+    AssetProcessFunc process;
+    void *user_data;
+
+    FileMapping mapping;
+    File data;
+    bool failed;
+
+    // NOTE: Only touched by the main thread, set when the request comes out of asset_loader_poll.
+    bool done;
+
+    Uint64 submit_time;
+    Uint64 start_time;
+    Uint64 complete_time;
+} AssetRequest;
+
+typedef struct AssetLoaderStats {
+    unsigned int queue_depth;
+    unsigned int max_queue_depth;
+    unsigned int in_flight;
+    unsigned long long loaded_count;
+    double avg_latency_ms;
+    double max_latency_ms;
+    double avg_wait_ms;
+} AssetLoaderStats;
+
+typedef struct AssetLoader {
+    SDL_Thread *workers[ASSET_LOADER_MAX_WORKERS];
+    unsigned int workers_count;
+    SDL_mutex *mutex;
+    SDL_cond *work_available;
+    bool quit;
+
+    // NOTE: Read only after asset_loader_mount_pack, workers share it without locking.
+    Pack *pack;
+
+    AssetRequest requests[ASSET_LOADER_MAX_REQUESTS];
+    unsigned int free_slots[ASSET_LOADER_MAX_REQUESTS];
+    unsigned int free_slots_count;
+
+    // NOTE: Binary max heap ordered by priority, then by submission order.
+    unsigned int pending[ASSET_LOADER_MAX_REQUESTS];
+    unsigned int pending_count;
+    unsigned long long next_sequence;
+
+    unsigned int completed[ASSET_LOADER_MAX_REQUESTS];
+    unsigned int completed_head;
+    unsigned int completed_count;
+
+    unsigned int in_flight;
+    unsigned int max_queue_depth;
+    unsigned long long loaded_count;
+    double total_latency_ms;
+    double total_wait_ms;
+    double max_latency_ms;
+} AssetLoader;
+
+static inline double asset_ticks_to_ms(Uint64 ticks) {
+    return (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static bool asset_request_before(AssetLoader *loader, unsigned int a, unsigned int b) {
+    AssetRequest *request_a = &loader->requests[a];
+    AssetRequest *request_b = &loader->requests[b];
+    if(request_a->priority != request_b->priority) {
+        return request_a->priority > request_b->priority;
+    }
+    return request_a->sequence < request_b->sequence;
+}
+
+static void asset_pending_push(AssetLoader *loader, unsigned int slot) {
+    unsigned int index     = loader->pending_count++;
+    loader->pending[index] = slot;
+    while(index > 0) {
+        unsigned int parent = (index - 1) / 2;
+        if(!asset_request_before(loader, loader->pending[index], loader->pending[parent])) {
+            break;
+        }
+        unsigned int tmp        = loader->pending[parent];
+        loader->pending[parent] = loader->pending[index];
+        loader->pending[index]  = tmp;
+        index                   = parent;
+    }
+}
+
+static unsigned int asset_pending_pop(AssetLoader *loader) {
+    unsigned int result = loader->pending[0];
+    loader->pending[0]  = loader->pending[--loader->pending_count];
+
+    unsigned int index = 0;
+    for(;;) {
+        unsigned int left  = index * 2 + 1;
+        unsigned int right = left + 1;
+        unsigned int best  = index;
+        if(left < loader->pending_count &&
+           asset_request_before(loader, loader->pending[left], loader->pending[best])) {
+            best = left;
+        }
+        if(right < loader->pending_count &&
+           asset_request_before(loader, loader->pending[right], loader->pending[best])) {
+            best = right;
+        }
+        if(best == index) {
+            break;
+        }
+        unsigned int tmp       = loader->pending[best];
+        loader->pending[best]  = loader->pending[index];
+        loader->pending[index] = tmp;
+        index                  = best;
+    }
+    return result;
+}
+
+static int asset_loader_worker(void *data) {
+    AssetLoader *loader = (AssetLoader *)data;
+
+    for(;;) {
+        SDL_LockMutex(loader->mutex);
+        while(loader->pending_count == 0 && !loader->quit) {
+            SDL_CondWait(loader->work_available, loader->mutex);
+        }
+        if(loader->quit) {
+            SDL_UnlockMutex(loader->mutex);
+            break;
+        }
+        unsigned int slot = asset_pending_pop(loader);
+        ++loader->in_flight;
+        SDL_UnlockMutex(loader->mutex);
+
+        AssetRequest *request = &loader->requests[slot];
+        request->start_time   = SDL_GetPerformanceCounter();
+        if(loader->pack && pack_find(loader->pack, request->path, &request->data)) {
+            request->failed = false;
+        } else {
+            request->mapping = file_map(request->path);
+            request->data    = file_view(&request->mapping, 0, request->mapping.size);
+            request->failed  = request->mapping.data == NULL;
+        }
+        if(!request->failed && request->process) {
+            request->process(request);
+        }
+        request->complete_time = SDL_GetPerformanceCounter();
+
+        SDL_LockMutex(loader->mutex);
+        unsigned int tail =
+            (loader->completed_head + loader->completed_count) % ASSET_LOADER_MAX_REQUESTS;
+        loader->completed[tail] = slot;
+        ++loader->completed_count;
+        --loader->in_flight;
+
+        double latency_ms = asset_ticks_to_ms(request->complete_time - request->submit_time);
+        ++loader->loaded_count;
+        loader->total_latency_ms += latency_ms;
+        loader->total_wait_ms += asset_ticks_to_ms(request->start_time - request->submit_time);
+        if(latency_ms > loader->max_latency_ms) {
+            loader->max_latency_ms = latency_ms;
+        }
+        SDL_UnlockMutex(loader->mutex);
+    }
+
+    return 0;
+}
+
+void asset_loader_init(AssetLoader *loader, unsigned int workers_count) {
+    memset(loader, 0, sizeof(*loader));
+    loader->mutex          = SDL_CreateMutex();
+    loader->work_available = SDL_CreateCond();
+
+    for(unsigned int slot = 0; slot < ASSET_LOADER_MAX_REQUESTS; ++slot) {
+        loader->free_slots[loader->free_slots_count++] = ASSET_LOADER_MAX_REQUESTS - 1 - slot;
+    }
+
+    if(workers_count > ASSET_LOADER_MAX_WORKERS) {
+        workers_count = ASSET_LOADER_MAX_WORKERS;
+    }
+    for(unsigned int worker_index = 0; worker_index < workers_count; ++worker_index) {
+        loader->workers[worker_index] =
+            SDL_CreateThread(asset_loader_worker, "asset_loader", loader);
+        if(loader->workers[worker_index] == NULL) {
+            printf("Failed to create asset loader thread!\n");
+            exit(1);
+        }
+    }
+    loader->workers_count = workers_count;
+}
+
+// NOTE: Mount before the first asset_load, the pack has to outlive the loader.
+void asset_loader_mount_pack(AssetLoader *loader, Pack *pack) {
+    assert(loader->next_sequence == 0);
+    loader->pack = pack;
+}
+
+AssetRequest *asset_load(AssetLoader *loader, const char *path, AssetPriority priority,
+                         AssetProcessFunc process, void *user_data) {
+    SDL_LockMutex(loader->mutex);
+    if(loader->free_slots_count == 0) {
+        printf("Too many asset requests in flight!\n");
+        exit(1);
+    }
+    unsigned int slot     = loader->free_slots[--loader->free_slots_count];
+    AssetRequest *request = &loader->requests[slot];
+    memset(request, 0, sizeof(*request));
+    snprintf(request->path, sizeof(request->path), "%s", path);
+    request->priority    = priority;
+    request->sequence    = loader->next_sequence++;
+    request->process     = process;
+    request->user_data   = user_data;
+    request->submit_time = SDL_GetPerformanceCounter();
+
+    asset_pending_push(loader, slot);
+    if(loader->pending_count > loader->max_queue_depth) {
+        loader->max_queue_depth = loader->pending_count;
+    }
+    SDL_CondSignal(loader->work_available);
+    SDL_UnlockMutex(loader->mutex);
+    return request;
+}
+
+// NOTE: Returns the next completed request or NULL, call it until it returns NULL once per frame.
+AssetRequest *asset_loader_poll(AssetLoader *loader) {
+    AssetRequest *request = NULL;
+    SDL_LockMutex(loader->mutex);
+    if(loader->completed_count > 0) {
+        unsigned int slot      = loader->completed[loader->completed_head];
+        loader->completed_head = (loader->completed_head + 1) % ASSET_LOADER_MAX_REQUESTS;
+        --loader->completed_count;
+        request       = &loader->requests[slot];
+        request->done = true;
+    }
+    SDL_UnlockMutex(loader->mutex);
+    return request;
+}
+
+// NOTE: Unmaps loose files, views into request->data are invalid after this.
+void asset_release(AssetLoader *loader, AssetRequest *request) {
+    assert(request->done);
+    file_unmap(&request->mapping);
+    SDL_LockMutex(loader->mutex);
+    loader->free_slots[loader->free_slots_count++] = (unsigned int)(request - loader->requests);
+    SDL_UnlockMutex(loader->mutex);
+}
+
+void asset_loader_shutdown(AssetLoader *loader) {
+    SDL_LockMutex(loader->mutex);
+    loader->quit = true;
+    SDL_CondBroadcast(loader->work_available);
+    SDL_UnlockMutex(loader->mutex);
+
+    for(unsigned int worker_index = 0; worker_index < loader->workers_count; ++worker_index) {
+        SDL_WaitThread(loader->workers[worker_index], NULL);
+    }
+    SDL_DestroyCond(loader->work_available);
+    SDL_DestroyMutex(loader->mutex);
+}
+
+AssetLoaderStats asset_loader_get_stats(AssetLoader *loader) {
+    AssetLoaderStats stats = { 0 };
+    SDL_LockMutex(loader->mutex);
+    stats.queue_depth     = loader->pending_count;
+    stats.max_queue_depth = loader->max_queue_depth;
+    stats.in_flight       = loader->in_flight;
+    stats.loaded_count    = loader->loaded_count;
+    stats.max_latency_ms  = loader->max_latency_ms;
+    if(loader->loaded_count > 0) {
+        stats.avg_latency_ms = loader->total_latency_ms / (double)loader->loaded_count;
+        stats.avg_wait_ms    = loader->total_wait_ms / (double)loader->loaded_count;
+    }
+    SDL_UnlockMutex(loader->mutex);
+    return stats;
+}
+
+void asset_loader_print_stats(AssetLoader *loader) {
+    AssetLoaderStats stats = asset_loader_get_stats(loader);
+    printf("assets: %llu loaded, queue depth %u (max %u), %u in flight, latency avg %.3f ms "
+           "max %.3f ms, queue wait avg %.3f ms\n",
+           stats.loaded_count, stats.queue_depth, stats.max_queue_depth, stats.in_flight,
+           stats.avg_latency_ms, stats.max_latency_ms, stats.avg_wait_ms);
+}
@@ -0,0 +1,432 @@
+// NOTE: CPU side micro benchmarks, run with no arguments to run them all or pass the names of the
+// ones you want, e.g. "vulkan_bench arena cull bvh jobs sort".
+
+#include "common.h"
+
+#define SDL_MAIN_HANDLED
+#include <SDL.h>
+#include <vulkan/vulkan.h>
+
+#include "arena.c"
+#include "job.c"
+#include "cull.c"
+#include "bvh.c"
+#include "draw_queue.c"
+
+static double bench_elapsed_ms(Uint64 start) {
+    Uint64 end = SDL_GetPerformanceCounter();
+    return (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// NOTE: Keeps the compiler from dropping work whose result is never read.
+static volatile unsigned char bench_sink;
+
+void bench_arena(void) {
+    printf("---- arena_push vs arena_push_no_zero (push + fill) ----\n");
+
+    size_t sizes[]          = { mb(1), mb(4), mb(16), mb(64) };
+    unsigned int iterations = 64;
+
+    Arena arena          = arena_create_virtual(gb(1), 0);
+    unsigned char *source = arena_push_no_zero(&arena, mb(64), 64);
+    memset(source, 0xab, mb(64));
+    TempMemory temp = temp_memory_begin(&arena);
+
+    for(unsigned int size_index = 0; size_index < array_len(sizes); ++size_index) {
+        size_t size = sizes[size_index];
+
+        // NOTE: Warm up so both variants run on committed, resident pages.
+        memset(arena_push_no_zero(&arena, size, 64), 0, size);
+        temp_memory_end(temp);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(unsigned int i = 0; i < iterations; ++i) {
+            unsigned char *data = arena_push(&arena, size, 64);
+            memcpy(data, source, size);
+            bench_sink = data[size - 1];
+            temp_memory_end(temp);
+        }
+        double zero_ms = bench_elapsed_ms(start) / iterations;
+
+        start = SDL_GetPerformanceCounter();
+        for(unsigned int i = 0; i < iterations; ++i) {
+            unsigned char *data = arena_push_no_zero(&arena, size, 64);
+            memcpy(data, source, size);
+            bench_sink = data[size - 1];
+            temp_memory_end(temp);
+        }
+        double no_zero_ms = bench_elapsed_ms(start) / iterations;
+
+        double size_gb = (double)size / gb(1);
+        printf("%4zu MB: zeroed %8.3f ms (%6.2f GB/s), no zero %8.3f ms (%6.2f GB/s), %.2fx\n",
+               (size_t)(size / mb(1)), zero_ms, size_gb / (zero_ms / 1000.0), no_zero_ms,
+               size_gb / (no_zero_ms / 1000.0), zero_ms / no_zero_ms);
+    }
+
+    arena_destroy(&arena);
+}
+
+static float bench_random(unsigned int *seed, float min, float max) {
+    *seed = *seed * 1664525u + 1013904223u;
+    return min + (max - min) * (float)(*seed >> 8) / (float)(1u << 24);
+}
+
+void bench_cull(void) {
+    printf("---- frustum culling of SoA bounding spheres ----\n");
+
+    unsigned int objects_count = 1000000;
+    unsigned int iterations    = 64;
+
+    Arena arena       = arena_create_virtual(gb(1), 0);
+    CullBounds bounds = cull_bounds_create(&arena, objects_count);
+    unsigned int seed = 1234;
+    for(unsigned int i = 0; i < objects_count; ++i) {
+        cull_bounds_push(&bounds, bench_random(&seed, -100.0f, 100.0f),
+                         bench_random(&seed, -100.0f, 100.0f), bench_random(&seed, -100.0f, 100.0f),
+                         bench_random(&seed, 0.5f, 2.0f));
+    }
+    unsigned int *visible = arena_push_array_no_zero(&arena, unsigned int, bounds.capacity);
+
+    // NOTE: A box of half size 50 around the origin, about an eighth of the objects are visible.
+    CullPlane planes[CULL_PLANES_COUNT] = {
+        { 1.0f, 0.0f, 0.0f, 50.0f }, { -1.0f, 0.0f, 0.0f, 50.0f }, { 0.0f, 1.0f, 0.0f, 50.0f },
+        { 0.0f, -1.0f, 0.0f, 50.0f }, { 0.0f, 0.0f, 1.0f, 50.0f }, { 0.0f, 0.0f, -1.0f, 50.0f },
+    };
+
+    CullPath best_path          = cull_best_path();
+    unsigned int expected_count = cull_spheres(CULL_PATH_SCALAR, &bounds, planes, visible);
+    for(CullPath path = CULL_PATH_SCALAR; path <= best_path; ++path) {
+        unsigned int visible_count = cull_spheres(path, &bounds, planes, visible);
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for(unsigned int i = 0; i < iterations; ++i) {
+            visible_count = cull_spheres(path, &bounds, planes, visible);
+            bench_sink    = (unsigned char)visible[visible_count / 2];
+        }
+        double ms = bench_elapsed_ms(start) / iterations;
+
+        printf("%-6s: %u objects, %u visible, %8.3f ms, %8.1f objects/us%s\n",
+               cull_path_names[path], objects_count, visible_count, ms,
+               (double)objects_count / (ms * 1000.0),
+               visible_count == expected_count ? "" : " (MISMATCH)");
+    }
+
+    arena_destroy(&arena);
+}
+
+void bench_bvh(void) {
+    printf("---- bvh build, refit and queries ----\n");
+
+    uint32_t objects_count = 1000000;
+    unsigned int seed      = 1234;
+
+    Arena arena       = arena_create_virtual(gb(4), 0);
+    BvhAabb *objects  = arena_push_array_no_zero(&arena, BvhAabb, objects_count);
+    CullBounds bounds = cull_bounds_create(&arena, objects_count);
+    for(uint32_t i = 0; i < objects_count; ++i) {
+        float half = bench_random(&seed, 0.25f, 1.0f);
+        float center[3];
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            center[axis]         = bench_random(&seed, -100.0f, 100.0f);
+            objects[i].min[axis] = center[axis] - half;
+            objects[i].max[axis] = center[axis] + half;
+        }
+        cull_bounds_push(&bounds, center[0], center[1], center[2], half * 1.7320508f);
+    }
+    uint32_t *result = arena_push_array_no_zero(&arena, uint32_t, bounds.capacity);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    Bvh bvh;
+    bvh_build(&bvh, &arena, objects, objects_count);
+    printf("build : %u objects, %u nodes, %8.3f ms\n", objects_count, bvh.nodes_count,
+           bench_elapsed_ms(start));
+
+    for(uint32_t i = 0; i < objects_count; ++i) {
+        float offset = bench_random(&seed, -0.5f, 0.5f);
+        objects[i].min[0] += offset;
+        objects[i].max[0] += offset;
+    }
+    start = SDL_GetPerformanceCounter();
+    bvh_refit(&bvh);
+    printf("refit : %8.3f ms\n", bench_elapsed_ms(start));
+
+    // NOTE: Narrow frustum looking down +z, a few percent of the scene is visible.
+    CullPlane planes[CULL_PLANES_COUNT] = {
+        { 1.0f, 0.0f, 0.5f, 0.0f },  { -1.0f, 0.0f, 0.5f, 0.0f }, { 0.0f, 1.0f, 0.5f, 0.0f },
+        { 0.0f, -1.0f, 0.5f, 0.0f }, { 0.0f, 0.0f, 1.0f, -1.0f }, { 0.0f, 0.0f, -1.0f, 100.0f },
+    };
+    unsigned int iterations = 64;
+
+    uint32_t visible_count = 0;
+    start                  = SDL_GetPerformanceCounter();
+    for(unsigned int i = 0; i < iterations; ++i) {
+        visible_count = bvh_query_frustum(&bvh, planes, CULL_PLANES_COUNT, result, objects_count);
+        bench_sink    = (unsigned char)visible_count;
+    }
+    double bvh_ms = bench_elapsed_ms(start) / iterations;
+
+    CullPath path           = cull_best_path();
+    unsigned int flat_count = 0;
+    start                   = SDL_GetPerformanceCounter();
+    for(unsigned int i = 0; i < iterations; ++i) {
+        flat_count = cull_spheres(path, &bounds, planes, result);
+        bench_sink = (unsigned char)flat_count;
+    }
+    double flat_ms = bench_elapsed_ms(start) / iterations;
+    printf("frustum: bvh %u visible %8.3f ms, flat %s %u visible %8.3f ms\n", visible_count,
+           bvh_ms, cull_path_names[path], flat_count, flat_ms);
+
+    unsigned int box_queries = 10000;
+    uint32_t box_hits        = 0;
+    start                    = SDL_GetPerformanceCounter();
+    for(unsigned int i = 0; i < box_queries; ++i) {
+        BvhAabb box;
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            box.min[axis] = bench_random(&seed, -100.0f, 95.0f);
+            box.max[axis] = box.min[axis] + 5.0f;
+        }
+        box_hits += bvh_query_aabb(&bvh, &box, result, objects_count);
+    }
+    double box_ms = bench_elapsed_ms(start);
+    printf("aabb  : %u queries, %u hits, %8.3f us/query\n", box_queries, box_hits,
+           box_ms * 1000.0 / box_queries);
+
+    unsigned int rays_count = 100000;
+    unsigned int rays_hit   = 0;
+    start                   = SDL_GetPerformanceCounter();
+    for(unsigned int i = 0; i < rays_count; ++i) {
+        float origin[3] = { bench_random(&seed, -100.0f, 100.0f),
+                            bench_random(&seed, -100.0f, 100.0f), -150.0f };
+        float dir[3]    = { bench_random(&seed, -0.2f, 0.2f), bench_random(&seed, -0.2f, 0.2f),
+                            1.0f };
+        uint32_t object = 0;
+        float t         = 0.0f;
+        rays_hit += bvh_raycast(&bvh, origin, dir, 1000.0f, &object, &t);
+    }
+    double rays_ms = bench_elapsed_ms(start);
+    printf("rays  : %u rays, %u hits, %8.1f rays/ms\n", rays_count, rays_hit,
+           rays_count / rays_ms);
+
+    arena_destroy(&arena);
+}
+
+static void bench_empty_job(void *data, unsigned int first, unsigned int count) {
+    unused(data);
+    unused(first);
+    unused(count);
+}
+
+// NOTE: Every nested job submits this many empty children and waits on them, so the outer jobs
+// stay queued while newer ones run.
+#define BENCH_NESTED_CHILDREN 10
+
+static void bench_nested_job(void *data, unsigned int first, unsigned int count) {
+    unused(first);
+    unused(count);
+    JobSystem *jobs    = (JobSystem *)data;
+    JobCounter counter = { 0 };
+    for(unsigned int child = 0; child < BENCH_NESTED_CHILDREN; ++child) {
+        job_submit(jobs, bench_empty_job, NULL, child, 1, &counter);
+    }
+    job_wait(jobs, &counter);
+}
+
+#define BENCH_CULL_JOB_SIZE 4096
+
+typedef struct BenchCullJob {
+    CullPath path;
+    CullBounds *bounds;
+    const CullPlane *planes;
+    unsigned int *visible;
+    unsigned int *counts;
+} BenchCullJob;
+
+static void bench_cull_job(void *data, unsigned int first, unsigned int count) {
+    BenchCullJob *job = (BenchCullJob *)data;
+    for(unsigned int chunk = first; chunk < first + count; ++chunk) {
+        unsigned int start = chunk * BENCH_CULL_JOB_SIZE;
+        job->counts[chunk] = cull_spheres_range(job->path, job->bounds, start, BENCH_CULL_JOB_SIZE,
+                                                job->planes, job->visible + start);
+    }
+}
+
+void bench_jobs(void) {
+    printf("---- job system overhead and parallel culling ----\n");
+
+    unsigned int objects_count = 1000000;
+    unsigned int iterations    = 64;
+    unsigned int cpus_count    = min((unsigned int)SDL_GetCPUCount(), JOB_MAX_WORKERS);
+
+    Arena arena       = arena_create_virtual(gb(1), 0);
+    CullBounds bounds = cull_bounds_create(&arena, objects_count);
+    unsigned int seed = 1234;
+    for(unsigned int i = 0; i < objects_count; ++i) {
+        cull_bounds_push(&bounds, bench_random(&seed, -100.0f, 100.0f),
+                         bench_random(&seed, -100.0f, 100.0f), bench_random(&seed, -100.0f, 100.0f),
+                         bench_random(&seed, 0.5f, 2.0f));
+    }
+    CullPlane planes[CULL_PLANES_COUNT] = {
+        { 1.0f, 0.0f, 0.0f, 50.0f }, { -1.0f, 0.0f, 0.0f, 50.0f }, { 0.0f, 1.0f, 0.0f, 50.0f },
+        { 0.0f, -1.0f, 0.0f, 50.0f }, { 0.0f, 0.0f, 1.0f, 50.0f }, { 0.0f, 0.0f, -1.0f, 50.0f },
+    };
+
+    unsigned int chunks_count = (objects_count + BENCH_CULL_JOB_SIZE - 1) / BENCH_CULL_JOB_SIZE;
+    BenchCullJob job          = { 0 };
+    job.path                  = cull_best_path();
+    job.bounds                = &bounds;
+    job.planes                = planes;
+    job.visible               = arena_push_array_no_zero(&arena, unsigned int, bounds.capacity);
+    job.counts                = arena_push_array_no_zero(&arena, unsigned int, chunks_count);
+
+    JobSystem *jobs     = arena_push_struct(&arena, JobSystem);
+    double single_ms    = 0.0;
+    unsigned int counts = 0;
+    for(unsigned int workers = 1;; workers = min(workers * 2, cpus_count)) {
+        job_system_init(jobs, workers);
+
+        // NOTE: Submit, run and wait on batches of empty jobs, what a job costs on its own.
+        unsigned int empty_jobs = 1024;
+        Uint64 start            = SDL_GetPerformanceCounter();
+        for(unsigned int i = 0; i < iterations; ++i) {
+            JobCounter counter = { 0 };
+            for(unsigned int job_index = 0; job_index < empty_jobs; ++job_index) {
+                job_submit(jobs, bench_empty_job, NULL, job_index, 1, &counter);
+            }
+            job_wait(jobs, &counter);
+        }
+        double empty_ns = bench_elapsed_ms(start) * 1000000.0 / (iterations * empty_jobs);
+
+        // NOTE: The same number of outer jobs, each waiting on children of its own.
+        start = SDL_GetPerformanceCounter();
+        for(unsigned int i = 0; i < iterations; ++i) {
+            JobCounter counter = { 0 };
+            for(unsigned int job_index = 0; job_index < empty_jobs; ++job_index) {
+                job_submit(jobs, bench_nested_job, jobs, job_index, 1, &counter);
+            }
+            job_wait(jobs, &counter);
+        }
+        double nested_ns = bench_elapsed_ms(start) * 1000000.0 /
+                           (iterations * empty_jobs * (BENCH_NESTED_CHILDREN + 1));
+
+        start = SDL_GetPerformanceCounter();
+        for(unsigned int i = 0; i < iterations; ++i) {
+            job_parallel_for(jobs, chunks_count, 1, bench_cull_job, &job);
+        }
+        double ms = bench_elapsed_ms(start) / iterations;
+        if(workers == 1) {
+            single_ms = ms;
+        }
+        counts = 0;
+        for(unsigned int chunk = 0; chunk < chunks_count; ++chunk) {
+            counts += job.counts[chunk];
+        }
+
+        printf("%2u workers: %6.1f ns/empty job, %6.1f ns/nested job, cull %u objects, %u visible, "
+               "%8.3f ms, %5.2fx\n",
+               workers, empty_ns, nested_ns, objects_count, counts, ms, single_ms / ms);
+        job_system_shutdown(jobs);
+        if(workers == cpus_count) {
+            break;
+        }
+    }
+
+    arena_destroy(&arena);
+}
+
+static int bench_compare_items(const void *a, const void *b) {
+    uint64_t key_a = ((const DrawSortItem *)a)->key;
+    uint64_t key_b = ((const DrawSortItem *)b)->key;
+    return key_a < key_b ? -1 : (key_a > key_b ? 1 : 0);
+}
+
+void bench_sort(void) {
+    printf("---- draw key radix sort vs qsort ----\n");
+
+    unsigned int iterations = 16;
+    Arena arena             = arena_create_virtual(gb(1), 0);
+    uint32_t counts[]       = { 10000, 100000, 1000000 };
+
+    // NOTE: A frame's worth of keys only differs in a few bytes, random keys need every pass.
+    const char *kinds[] = { "4 materials", "random" };
+    for(unsigned int kind = 0; kind < array_len(kinds); ++kind) {
+        for(unsigned int count_index = 0; count_index < array_len(counts); ++count_index) {
+            uint32_t count        = counts[count_index];
+            TempMemory temp       = temp_memory_begin(&arena);
+            DrawSortItem *source  = arena_push_array_no_zero(&arena, DrawSortItem, count);
+            DrawSortItem *items   = arena_push_array_no_zero(&arena, DrawSortItem, count);
+            DrawSortItem *scratch = arena_push_array_no_zero(&arena, DrawSortItem, count);
+            DrawSortItem *sorted  = arena_push_array_no_zero(&arena, DrawSortItem, count);
+            unsigned int seed     = 1234;
+            for(uint32_t i = 0; i < count; ++i) {
+                seed = seed * 1664525u + 1013904223u;
+                if(kind == 0) {
+                    source[i].key = draw_key(0, (seed >> 8) & 1, (seed >> 9) & 1, 0);
+                } else {
+                    uint32_t high = seed;
+                    seed          = seed * 1664525u + 1013904223u;
+                    source[i].key = ((uint64_t)high << 32) | seed;
+                }
+                source[i].packet = i;
+            }
+
+            unsigned int passes_count = 0;
+            Uint64 start              = SDL_GetPerformanceCounter();
+            for(unsigned int i = 0; i < iterations; ++i) {
+                memcpy(items, source, count * sizeof(DrawSortItem));
+                passes_count = draw_radix_sort(items, scratch, count);
+            }
+            double radix_ms = bench_elapsed_ms(start) / iterations;
+
+            start = SDL_GetPerformanceCounter();
+            for(unsigned int i = 0; i < iterations; ++i) {
+                memcpy(sorted, source, count * sizeof(DrawSortItem));
+                qsort(sorted, count, sizeof(DrawSortItem), bench_compare_items);
+            }
+            double qsort_ms = bench_elapsed_ms(start) / iterations;
+
+            // NOTE: The radix sort is stable, equal keys keep their packet order.
+            bool ordered = true;
+            for(uint32_t i = 1; i < count; ++i) {
+                ordered = ordered && (items[i - 1].key < items[i].key ||
+                                      (items[i - 1].key == items[i].key &&
+                                       items[i - 1].packet < items[i].packet));
+                ordered = ordered && items[i].key == sorted[i].key;
+            }
+
+            printf("%-11s: %7u keys, %u/%u passes, radix %8.3f ms, qsort %8.3f ms, %5.2fx%s\n",
+                   kinds[kind], count, passes_count, DRAW_RADIX_PASSES, radix_ms, qsort_ms,
+                   qsort_ms / radix_ms, ordered ? "" : " (NOT SORTED)");
+            temp_memory_end(temp);
+        }
+    }
+
+    arena_destroy(&arena);
+}
+
+typedef struct Bench {
+    const char *name;
+    void (*run)(void);
+} Bench;
+
+Bench benches[] = {
+    { "arena", bench_arena },
+    { "cull",  bench_cull  },
+    { "bvh",   bench_bvh   },
+    { "jobs",  bench_jobs  },
+    { "sort",  bench_sort  },
+};
+
+int main(int argc, char **argv) {
+    for(unsigned int bench_index = 0; bench_index < array_len(benches); ++bench_index) {
+        bool selected = argc <= 1;
+        for(int arg_index = 1; arg_index < argc; ++arg_index) {
+            if(strcmp(argv[arg_index], benches[bench_index].name) == 0) {
+                selected = true;
+            }
+        }
+        if(selected) {
+            benches[bench_index].run();
+        }
+    }
+    return 0;
+}
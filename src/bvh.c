@@ -0,0 +1,526 @@
+// NOTE: Bounding volume hierarchy over object AABBs. The build uses a binned SAH and the nodes are
+// stored flattened in one array: 32 bytes each (two per cache line), the two children of a node
+// are always next to each other and always come after their parent. Leaves reference a contiguous
+// range of the index array, so an object is found with nodes[..].first + i. Because children come
+// after their parent a refit is a single reverse pass over the nodes, no rebuild is needed when
+// objects move as long as the tree quality holds up.
+//
+// Queries use an explicit stack. The frustum and AABB queries stop testing a subtree as soon as a
+// node is fully inside (every object below is emitted) and skip it when it is fully outside.
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_STACK_SIZE 128
+
+typedef struct BvhAabb {
+    float min[3];
+    float max[3];
+} BvhAabb;
+
+// NOTE: count == 0 marks an inner node, its children are left_first and left_first + 1. For leaves
+// left_first is the first entry in the index array.
+typedef struct BvhNode {
+    float min[3];
+    uint32_t left_first;
+    float max[3];
+    uint32_t count;
+} BvhNode;
+
+typedef struct Bvh {
+    BvhNode *nodes;
+    uint32_t nodes_count;
+    uint32_t *indices;
+
+    // NOTE: Owned by the caller, update the boxes and call bvh_refit when objects move.
+    BvhAabb *objects;
+    uint32_t objects_count;
+} Bvh;
+
+static inline void bvh_aabb_reset(BvhAabb *aabb) {
+    for(unsigned int axis = 0; axis < 3; ++axis) {
+        aabb->min[axis] = FLT_MAX;
+        aabb->max[axis] = -FLT_MAX;
+    }
+}
+
+static inline void bvh_aabb_grow(BvhAabb *aabb, const float *min, const float *max) {
+    for(unsigned int axis = 0; axis < 3; ++axis) {
+        aabb->min[axis] = min(aabb->min[axis], min[axis]);
+        aabb->max[axis] = max(aabb->max[axis], max[axis]);
+    }
+}
+
+static inline float bvh_aabb_area(BvhAabb *aabb) {
+    float x = aabb->max[0] - aabb->min[0];
+    float y = aabb->max[1] - aabb->min[1];
+    float z = aabb->max[2] - aabb->min[2];
+    return x * y + y * z + z * x;
+}
+
+static void bvh_update_node_bounds(Bvh *bvh, BvhNode *node) {
+    BvhAabb bounds;
+    bvh_aabb_reset(&bounds);
+    if(node->count > 0) {
+        for(uint32_t i = 0; i < node->count; ++i) {
+            BvhAabb *object = &bvh->objects[bvh->indices[node->left_first + i]];
+            bvh_aabb_grow(&bounds, object->min, object->max);
+        }
+    } else {
+        BvhNode *left  = &bvh->nodes[node->left_first];
+        BvhNode *right = &bvh->nodes[node->left_first + 1];
+        bvh_aabb_grow(&bounds, left->min, left->max);
+        bvh_aabb_grow(&bounds, right->min, right->max);
+    }
+    memcpy(node->min, bounds.min, sizeof(node->min));
+    memcpy(node->max, bounds.max, sizeof(node->max));
+}
+
+typedef struct BvhBin {
+    BvhAabb bounds;
+    uint32_t count;
+} BvhBin;
+
+// NOTE: The build works on a copy of the boxes that is partitioned together with the indices, so
+// every pass over a node reads memory sequentially instead of jumping through the index array.
+typedef struct BvhBuildItem {
+    BvhAabb bounds;
+    float centroid[3];
+    uint32_t object;
+} BvhBuildItem;
+
+// NOTE: Objects whose centroid falls in a bin below plane go left. The partition recomputes the
+// bin with the same centroid_min and scale as the sweep, since comparing against the plane's
+// position rounds differently and could put an object outside its child's bounds.
+typedef struct BvhSplit {
+    unsigned int axis;
+    unsigned int plane;
+    float centroid_min;
+    float scale;
+    float cost;
+    BvhAabb left_bounds;
+    BvhAabb right_bounds;
+} BvhSplit;
+
+// NOTE: Finds the cheapest SAH split of the node, the cost is FLT_MAX when the centroids of the
+// node can't be separated. All three axes are binned in the same pass and the bounds of both
+// children come out of the sweep, so they don't need another pass over the objects.
+static inline unsigned int bvh_bin_index(float centroid, float centroid_min, float scale) {
+    unsigned int bin = (unsigned int)((centroid - centroid_min) * scale);
+    return min(bin, BVH_BINS - 1);
+}
+
+static BvhSplit bvh_find_split(BvhBuildItem *items, BvhNode *node) {
+    float centroid_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float centroid_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for(uint32_t i = 0; i < node->count; ++i) {
+        BvhBuildItem *item = &items[node->left_first + i];
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            centroid_min[axis] = min(centroid_min[axis], item->centroid[axis]);
+            centroid_max[axis] = max(centroid_max[axis], item->centroid[axis]);
+        }
+    }
+
+    BvhBin bins[3][BVH_BINS];
+    float scale[3];
+    for(unsigned int axis = 0; axis < 3; ++axis) {
+        for(unsigned int bin = 0; bin < BVH_BINS; ++bin) {
+            bvh_aabb_reset(&bins[axis][bin].bounds);
+            bins[axis][bin].count = 0;
+        }
+        float extent = centroid_max[axis] - centroid_min[axis];
+        scale[axis]  = extent > 0.0f ? (float)BVH_BINS / extent : 0.0f;
+    }
+    for(uint32_t i = 0; i < node->count; ++i) {
+        BvhBuildItem *item = &items[node->left_first + i];
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            unsigned int bin =
+                bvh_bin_index(item->centroid[axis], centroid_min[axis], scale[axis]);
+            bvh_aabb_grow(&bins[axis][bin].bounds, item->bounds.min, item->bounds.max);
+            ++bins[axis][bin].count;
+        }
+    }
+
+    BvhSplit best = { 0 };
+    best.cost     = FLT_MAX;
+    for(unsigned int axis = 0; axis < 3; ++axis) {
+        if(scale[axis] == 0.0f) {
+            continue;
+        }
+
+        // NOTE: Sweep from both sides so every one of the BVH_BINS - 1 planes is costed in O(1).
+        BvhAabb left_bounds[BVH_BINS - 1];
+        uint32_t left_counts[BVH_BINS - 1];
+        BvhAabb bounds;
+        bvh_aabb_reset(&bounds);
+        uint32_t left_count = 0;
+        for(unsigned int plane = 0; plane < BVH_BINS - 1; ++plane) {
+            BvhBin *bin = &bins[axis][plane];
+            left_count += bin->count;
+            bvh_aabb_grow(&bounds, bin->bounds.min, bin->bounds.max);
+            left_counts[plane] = left_count;
+            left_bounds[plane] = bounds;
+        }
+
+        bvh_aabb_reset(&bounds);
+        uint32_t right_count = 0;
+        for(unsigned int plane = BVH_BINS - 1; plane > 0; --plane) {
+            BvhBin *bin = &bins[axis][plane];
+            right_count += bin->count;
+            bvh_aabb_grow(&bounds, bin->bounds.min, bin->bounds.max);
+            if(left_counts[plane - 1] == 0 || right_count == 0) {
+                continue;
+            }
+            float cost = left_counts[plane - 1] * bvh_aabb_area(&left_bounds[plane - 1]) +
+                         right_count * bvh_aabb_area(&bounds);
+            if(cost < best.cost) {
+                best.axis         = axis;
+                best.plane        = plane;
+                best.centroid_min = centroid_min[axis];
+                best.scale        = scale[axis];
+                best.cost         = cost;
+                best.left_bounds  = left_bounds[plane - 1];
+                best.right_bounds = bounds;
+            }
+        }
+    }
+    return best;
+}
+
+static inline void bvh_node_set_bounds(BvhNode *node, BvhAabb *bounds) {
+    memcpy(node->min, bounds->min, sizeof(node->min));
+    memcpy(node->max, bounds->max, sizeof(node->max));
+}
+
+// NOTE: objects must stay alive as long as the bvh, the nodes and indices are pushed on the arena.
+void bvh_build(Bvh *bvh, Arena *arena, BvhAabb *objects, uint32_t objects_count) {
+    memset(bvh, 0, sizeof(*bvh));
+    bvh->objects       = objects;
+    bvh->objects_count = objects_count;
+    bvh->nodes         = arena_push_array_no_zero(arena, BvhNode, max(objects_count * 2, 1));
+    bvh->indices       = arena_push_array_no_zero(arena, uint32_t, objects_count);
+    if(objects_count == 0) {
+        return;
+    }
+
+    TempMemory temp     = temp_memory_begin(arena);
+    BvhBuildItem *items = arena_push_array_no_zero(arena, BvhBuildItem, objects_count);
+    BvhAabb root_bounds;
+    bvh_aabb_reset(&root_bounds);
+    for(uint32_t object = 0; object < objects_count; ++object) {
+        BvhBuildItem *item = &items[object];
+        item->bounds       = objects[object];
+        item->object       = object;
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            item->centroid[axis] = (item->bounds.min[axis] + item->bounds.max[axis]) * 0.5f;
+        }
+        bvh_aabb_grow(&root_bounds, item->bounds.min, item->bounds.max);
+    }
+
+    BvhNode *root    = &bvh->nodes[0];
+    root->left_first = 0;
+    root->count      = objects_count;
+    bvh->nodes_count = 1;
+    bvh_node_set_bounds(root, &root_bounds);
+
+    uint32_t stack[BVH_STACK_SIZE];
+    unsigned int stack_count = 0;
+    stack[stack_count++]     = 0;
+    while(stack_count > 0) {
+        BvhNode *node = &bvh->nodes[stack[--stack_count]];
+        if(node->count <= BVH_MAX_LEAF_SIZE) {
+            continue;
+        }
+
+        BvhSplit split = bvh_find_split(items, node);
+        BvhAabb node_bounds;
+        memcpy(node_bounds.min, node->min, sizeof(node_bounds.min));
+        memcpy(node_bounds.max, node->max, sizeof(node_bounds.max));
+        if(split.cost >= node->count * bvh_aabb_area(&node_bounds)) {
+            continue;
+        }
+
+        // NOTE: Partition the range in place, each child keeps a contiguous range.
+        uint32_t first = node->left_first;
+        uint32_t last  = node->left_first + node->count - 1;
+        uint32_t i     = first;
+        while(i <= last) {
+            if(bvh_bin_index(items[i].centroid[split.axis], split.centroid_min, split.scale) <
+               split.plane) {
+                ++i;
+            } else {
+                BvhBuildItem tmp = items[i];
+                items[i]         = items[last];
+                items[last]      = tmp;
+                if(last == 0) {
+                    break;
+                }
+                --last;
+            }
+        }
+        uint32_t left_count = i - first;
+        if(left_count == 0 || left_count == node->count) {
+            continue;
+        }
+
+        uint32_t left_index = bvh->nodes_count;
+        bvh->nodes_count += 2;
+        BvhNode *left     = &bvh->nodes[left_index];
+        BvhNode *right    = &bvh->nodes[left_index + 1];
+        left->left_first  = first;
+        left->count       = left_count;
+        right->left_first = i;
+        right->count      = node->count - left_count;
+        node->left_first  = left_index;
+        node->count       = 0;
+        bvh_node_set_bounds(left, &split.left_bounds);
+        bvh_node_set_bounds(right, &split.right_bounds);
+
+        assert(stack_count + 2 <= BVH_STACK_SIZE);
+        stack[stack_count++] = left_index;
+        stack[stack_count++] = left_index + 1;
+    }
+
+    for(uint32_t i = 0; i < objects_count; ++i) {
+        bvh->indices[i] = items[i].object;
+    }
+    temp_memory_end(temp);
+}
+
+void bvh_refit(Bvh *bvh) {
+    for(uint32_t node_index = bvh->nodes_count; node_index > 0; --node_index) {
+        bvh_update_node_bounds(bvh, &bvh->nodes[node_index - 1]);
+    }
+}
+
+// NOTE: Appends every object of the subtree, no more tests are needed once a node is fully inside.
+static uint32_t bvh_emit_subtree(Bvh *bvh, uint32_t node_index, uint32_t *result,
+                                 uint32_t result_count, uint32_t result_capacity) {
+    uint32_t stack[BVH_STACK_SIZE];
+    unsigned int stack_count = 0;
+    stack[stack_count++]     = node_index;
+    while(stack_count > 0) {
+        BvhNode *node = &bvh->nodes[stack[--stack_count]];
+        if(node->count > 0) {
+            for(uint32_t i = 0; i < node->count && result_count < result_capacity; ++i) {
+                result[result_count++] = bvh->indices[node->left_first + i];
+            }
+        } else {
+            stack[stack_count++] = node->left_first;
+            stack[stack_count++] = node->left_first + 1;
+        }
+    }
+    return result_count;
+}
+
+// NOTE: Returns false when the box is fully behind one of the planes in mask, and clears the bits
+// of the planes the box is fully in front of.
+static inline bool bvh_aabb_frustum(const float *min, const float *max, const CullPlane *planes,
+                                    unsigned int planes_count, uint32_t *mask) {
+    for(unsigned int plane_index = 0; plane_index < planes_count; ++plane_index) {
+        if(!(*mask & (1u << plane_index))) {
+            continue;
+        }
+        const CullPlane *plane = &planes[plane_index];
+        float normal[3]        = { plane->x, plane->y, plane->z };
+        float far_distance     = plane->d;
+        float near_distance    = plane->d;
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            // NOTE: The corners furthest along and against the plane normal.
+            float positive = normal[axis] >= 0.0f ? max[axis] : min[axis];
+            float negative = normal[axis] >= 0.0f ? min[axis] : max[axis];
+            far_distance += normal[axis] * positive;
+            near_distance += normal[axis] * negative;
+        }
+        if(far_distance < 0.0f) {
+            return false;
+        }
+        if(near_distance >= 0.0f) {
+            *mask &= ~(1u << plane_index);
+        }
+    }
+    return true;
+}
+
+// NOTE: Writes up to result_capacity indices of the objects whose box touches the frustum. Each
+// stack entry carries the planes its parent was not already fully inside of.
+uint32_t bvh_query_frustum(Bvh *bvh, const CullPlane *planes, unsigned int planes_count,
+                           uint32_t *result, uint32_t result_capacity) {
+    assert(planes_count <= 32);
+    if(bvh->nodes_count == 0) {
+        return 0;
+    }
+
+    uint32_t stack_nodes[BVH_STACK_SIZE];
+    uint32_t stack_masks[BVH_STACK_SIZE];
+    unsigned int stack_count = 0;
+    stack_nodes[stack_count] = 0;
+    stack_masks[stack_count] = planes_count == 32 ? 0xffffffff : (1u << planes_count) - 1;
+    ++stack_count;
+
+    uint32_t result_count = 0;
+    while(stack_count > 0) {
+        --stack_count;
+        uint32_t node_index = stack_nodes[stack_count];
+        uint32_t mask       = stack_masks[stack_count];
+        BvhNode *node       = &bvh->nodes[node_index];
+        if(!bvh_aabb_frustum(node->min, node->max, planes, planes_count, &mask)) {
+            continue;
+        }
+
+        if(mask == 0) {
+            result_count =
+                bvh_emit_subtree(bvh, node_index, result, result_count, result_capacity);
+        } else if(node->count > 0) {
+            for(uint32_t i = 0; i < node->count && result_count < result_capacity; ++i) {
+                uint32_t index     = bvh->indices[node->left_first + i];
+                BvhAabb *object    = &bvh->objects[index];
+                uint32_t leaf_mask = mask;
+                if(bvh_aabb_frustum(object->min, object->max, planes, planes_count, &leaf_mask)) {
+                    result[result_count++] = index;
+                }
+            }
+        } else {
+            assert(stack_count + 2 <= BVH_STACK_SIZE);
+            stack_nodes[stack_count] = node->left_first;
+            stack_masks[stack_count] = mask;
+            ++stack_count;
+            stack_nodes[stack_count] = node->left_first + 1;
+            stack_masks[stack_count] = mask;
+            ++stack_count;
+        }
+    }
+    return result_count;
+}
+
+uint32_t bvh_query_aabb(Bvh *bvh, BvhAabb *box, uint32_t *result, uint32_t result_capacity) {
+    if(bvh->nodes_count == 0) {
+        return 0;
+    }
+
+    uint32_t stack[BVH_STACK_SIZE];
+    unsigned int stack_count = 0;
+    stack[stack_count++]     = 0;
+
+    uint32_t result_count = 0;
+    while(stack_count > 0) {
+        uint32_t node_index = stack[--stack_count];
+        BvhNode *node       = &bvh->nodes[node_index];
+
+        bool overlaps = true;
+        bool inside   = true;
+        for(unsigned int axis = 0; axis < 3; ++axis) {
+            overlaps = overlaps && node->min[axis] <= box->max[axis] &&
+                       node->max[axis] >= box->min[axis];
+            inside = inside && node->min[axis] >= box->min[axis] &&
+                     node->max[axis] <= box->max[axis];
+        }
+        if(!overlaps) {
+            continue;
+        }
+
+        if(inside) {
+            result_count =
+                bvh_emit_subtree(bvh, node_index, result, result_count, result_capacity);
+        } else if(node->count > 0) {
+            for(uint32_t i = 0; i < node->count && result_count < result_capacity; ++i) {
+                BvhAabb *object = &bvh->objects[bvh->indices[node->left_first + i]];
+                bool hit        = true;
+                for(unsigned int axis = 0; axis < 3; ++axis) {
+                    hit = hit && object->min[axis] <= box->max[axis] &&
+                          object->max[axis] >= box->min[axis];
+                }
+                if(hit) {
+                    result[result_count++] = bvh->indices[node->left_first + i];
+                }
+            }
+        } else {
+            assert(stack_count + 2 <= BVH_STACK_SIZE);
+            stack[stack_count++] = node->left_first;
+            stack[stack_count++] = node->left_first + 1;
+        }
+    }
+    return result_count;
+}
+
+// NOTE: Slab test, returns the entry distance or FLT_MAX on a miss.
+static inline float bvh_ray_aabb(const float *origin, const float *inv_dir, const float *min,
+                                 const float *max, float t_max) {
+    float t_near = 0.0f;
+    float t_far  = t_max;
+    for(unsigned int axis = 0; axis < 3; ++axis) {
+        float t0 = (min[axis] - origin[axis]) * inv_dir[axis];
+        float t1 = (max[axis] - origin[axis]) * inv_dir[axis];
+        t_near   = max(t_near, min(t0, t1));
+        t_far    = min(t_far, max(t0, t1));
+    }
+    return t_near <= t_far ? t_near : FLT_MAX;
+}
+
+// NOTE: Finds the closest object box hit by the ray within t_max. The nearer child is visited
+// first and subtrees further away than the current hit are skipped.
+bool bvh_raycast(Bvh *bvh, const float *origin, const float *dir, float t_max, uint32_t *object,
+                 float *t) {
+    if(bvh->nodes_count == 0) {
+        return false;
+    }
+
+    float inv_dir[3];
+    for(unsigned int axis = 0; axis < 3; ++axis) {
+        inv_dir[axis] = dir[axis] != 0.0f ? 1.0f / dir[axis] : FLT_MAX;
+    }
+
+    bool hit      = false;
+    float closest = t_max;
+    uint32_t stack[BVH_STACK_SIZE];
+    unsigned int stack_count = 0;
+    if(bvh_ray_aabb(origin, inv_dir, bvh->nodes[0].min, bvh->nodes[0].max, closest) == FLT_MAX) {
+        return false;
+    }
+    stack[stack_count++] = 0;
+
+    while(stack_count > 0) {
+        BvhNode *node = &bvh->nodes[stack[--stack_count]];
+        if(node->count > 0) {
+            for(uint32_t i = 0; i < node->count; ++i) {
+                uint32_t index = bvh->indices[node->left_first + i];
+                BvhAabb *box   = &bvh->objects[index];
+                float distance = bvh_ray_aabb(origin, inv_dir, box->min, box->max, closest);
+                if(distance < closest) {
+                    closest = distance;
+                    *object = index;
+                    hit     = true;
+                }
+            }
+            continue;
+        }
+
+        uint32_t near_index = node->left_first;
+        uint32_t far_index  = node->left_first + 1;
+        BvhNode *near_node  = &bvh->nodes[near_index];
+        BvhNode *far_node   = &bvh->nodes[far_index];
+        float near_distance =
+            bvh_ray_aabb(origin, inv_dir, near_node->min, near_node->max, closest);
+        float far_distance = bvh_ray_aabb(origin, inv_dir, far_node->min, far_node->max, closest);
+        if(far_distance < near_distance) {
+            uint32_t tmp_index = near_index;
+            near_index         = far_index;
+            far_index          = tmp_index;
+            float tmp_distance = near_distance;
+            near_distance      = far_distance;
+            far_distance       = tmp_distance;
+        }
+        // NOTE: The near child is pushed last so it is popped first.
+        assert(stack_count + 2 <= BVH_STACK_SIZE);
+        if(far_distance < closest) {
+            stack[stack_count++] = far_index;
+        }
+        if(near_distance < closest) {
+            stack[stack_count++] = near_index;
+        }
+    }
+
+    if(hit) {
+        *t = closest;
+    }
+    return hit;
+}
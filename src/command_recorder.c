@@ -0,0 +1,159 @@
+// NOTE: Parallel command recording. A long draw list is split in slices, every slice is recorded
+// into a secondary command buffer by a job and the primary executes them in order with
+// vkCmdExecuteCommands. Each slice owns one command pool per frame in flight and a slice is only
+// ever recorded by one job, so no locking is needed around recording no matter which worker picks
+// it up, and a frame's pools are reset in one call once its fence signals. The calling thread
+// records slices too while it waits for the jobs.
+
+#define COMMAND_RECORDER_MAX_SLICES 16
+#define COMMAND_RECORDER_MIN_SLICE 1024
+
+typedef void CommandRecordFunc(VkCommandBuffer command_buffer, void *user, unsigned int first,
+                               unsigned int count, unsigned int frame);
+
+typedef struct CommandRecorderSlice {
+    VkCommandPool pools[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBuffer buffers[MAX_FRAMES_IN_FLIGHT];
+} CommandRecorderSlice;
+
+typedef struct CommandRecorder {
+    VkDevice device;
+    JobSystem *jobs;
+    CommandRecorderSlice slices[COMMAND_RECORDER_MAX_SLICES];
+    unsigned int slices_capacity;
+    unsigned int frames_count;
+    // NOTE: At most this many slices per batch, lowered to measure how recording scales.
+    unsigned int max_slices;
+    // NOTE: The statistics of a pipeline statistics query active in the primary, if any.
+    VkQueryPipelineStatisticFlags pipeline_statistics;
+
+    // NOTE: The batch being recorded, written before its jobs are submitted.
+    CommandRecordFunc *record;
+    void *user;
+    unsigned int frame;
+    unsigned int items_count;
+    unsigned int slices_count;
+    VkCommandBufferInheritanceInfo inheritance;
+} CommandRecorder;
+
+static void command_recorder_record_slice(CommandRecorder *recorder, unsigned int slice) {
+    VkCommandBuffer command_buffer = recorder->slices[slice].buffers[recorder->frame];
+
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                                          VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo         = &recorder->inheritance;
+    if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        printf("Failed to begin recording secondary command buffer!\n");
+        exit(1);
+    }
+
+    // NOTE: Slices differ by at most one item.
+    unsigned int base  = recorder->items_count / recorder->slices_count;
+    unsigned int extra = recorder->items_count % recorder->slices_count;
+    unsigned int first = slice * base + min(slice, extra);
+    unsigned int count = base + (slice < extra ? 1 : 0);
+    recorder->record(command_buffer, recorder->user, first, count, recorder->frame);
+
+    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        printf("Failed to record secondary command buffer!\n");
+        exit(1);
+    }
+}
+
+static void command_recorder_job(void *data, unsigned int first, unsigned int count) {
+    CommandRecorder *recorder = (CommandRecorder *)data;
+    for(unsigned int slice = first; slice < first + count; ++slice) {
+        command_recorder_record_slice(recorder, slice);
+    }
+}
+
+void command_recorder_init(CommandRecorder *recorder, JobSystem *jobs, VkDevice device,
+                           unsigned int queue_family, unsigned int slices_count,
+                           unsigned int frames_count) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->device          = device;
+    recorder->jobs            = jobs;
+    recorder->slices_capacity = clamp(slices_count, 1, COMMAND_RECORDER_MAX_SLICES);
+    recorder->max_slices      = recorder->slices_capacity;
+    recorder->frames_count    = clamp(frames_count, 1, MAX_FRAMES_IN_FLIGHT);
+
+    for(unsigned int slice_index = 0; slice_index < recorder->slices_capacity; ++slice_index) {
+        CommandRecorderSlice *slice = &recorder->slices[slice_index];
+        for(unsigned int frame = 0; frame < recorder->frames_count; ++frame) {
+            VkCommandPoolCreateInfo pool_info = { 0 };
+            pool_info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            pool_info.flags                   = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            pool_info.queueFamilyIndex        = queue_family;
+            if(vkCreateCommandPool(device, &pool_info, NULL, &slice->pools[frame]) !=
+               VK_SUCCESS) {
+                printf("Failed to create command pool!\n");
+                exit(1);
+            }
+
+            VkCommandBufferAllocateInfo alloc_info = { 0 };
+            alloc_info.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            alloc_info.commandPool        = slice->pools[frame];
+            alloc_info.level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            alloc_info.commandBufferCount = 1;
+            if(vkAllocateCommandBuffers(device, &alloc_info, &slice->buffers[frame]) !=
+               VK_SUCCESS) {
+                printf("Failed to allocate command buffers!\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+// NOTE: Call once the fence of the frame signaled, before recording into it again.
+void command_recorder_begin_frame(CommandRecorder *recorder, unsigned int frame) {
+    for(unsigned int slice = 0; slice < recorder->slices_capacity; ++slice) {
+        vkResetCommandPool(recorder->device, recorder->slices[slice].pools[frame], 0);
+    }
+}
+
+// NOTE: Records items_count items with record, split over the job workers in slices of at least
+// COMMAND_RECORDER_MIN_SLICE items, and executes them from primary. primary must be inside
+// render_pass, begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, or VK_NULL_HANDLE to
+// only record. Returns how many secondary command buffers were used.
+unsigned int command_recorder_record(CommandRecorder *recorder, VkCommandBuffer primary,
+                                     VkRenderPass render_pass, VkFramebuffer framebuffer,
+                                     unsigned int frame, unsigned int items_count,
+                                     CommandRecordFunc *record, void *user) {
+    unsigned int slices_count = (items_count + COMMAND_RECORDER_MIN_SLICE - 1) /
+                                COMMAND_RECORDER_MIN_SLICE;
+    slices_count              = clamp(slices_count, 1, recorder->max_slices);
+
+    VkCommandBufferInheritanceInfo inheritance = { 0 };
+    inheritance.sType                          = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass                     = render_pass;
+    inheritance.subpass                        = 0;
+    inheritance.framebuffer                    = framebuffer;
+    inheritance.pipelineStatistics             = recorder->pipeline_statistics;
+
+    recorder->record       = record;
+    recorder->user         = user;
+    recorder->frame        = frame;
+    recorder->items_count  = items_count;
+    recorder->slices_count = slices_count;
+    recorder->inheritance  = inheritance;
+    job_parallel_for(recorder->jobs, slices_count, 1, command_recorder_job, recorder);
+
+    VkCommandBuffer buffers[COMMAND_RECORDER_MAX_SLICES];
+    for(unsigned int slice = 0; slice < slices_count; ++slice) {
+        buffers[slice] = recorder->slices[slice].buffers[frame];
+    }
+    if(primary != VK_NULL_HANDLE) {
+        vkCmdExecuteCommands(primary, slices_count, buffers);
+    }
+    return slices_count;
+}
+
+void command_recorder_shutdown(CommandRecorder *recorder) {
+    for(unsigned int slice = 0; slice < recorder->slices_capacity; ++slice) {
+        for(unsigned int frame = 0; frame < recorder->frames_count; ++frame) {
+            vkDestroyCommandPool(recorder->device, recorder->slices[slice].pools[frame], NULL);
+        }
+    }
+}
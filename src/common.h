@@ -0,0 +1,136 @@
+#ifndef COMMON_H
+#define COMMON_H
+
+// NOTE: Expose mmap flags and the other POSIX bits hidden by -std=c11.
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#define array_len(v) (sizeof((v)) / sizeof((v)[0]))
+#define is_power_of_two(expr) (((expr) & (expr - 1)) == 0)
+#define unused(v) ((void)(v))
+
+#define kb(x) ((x) * 1024ll)
+#define mb(x) (kb(x) * 1024ll)
+#define gb(x) (mb(x) * 1024ll)
+
+// NOTE: windows.h defines the same two macros, only when they are not defined yet.
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#define clamp(a, b, c) max(min(a, c), b)
+
+// NOTE: The few atomic operations the job system needs. Loads are acquire, stores are release and
+// the read-modify-write operations and atomic_fence are sequentially consistent. On MSVC plain
+// volatile accesses already have acquire/release semantics on x86 and x64, the compiler barrier
+// only keeps the optimizer from moving other memory accesses across them.
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+static inline int32_t atomic_load_i32(volatile int32_t *value) {
+    int32_t result = *value;
+    _ReadWriteBarrier();
+    return result;
+}
+
+static inline void atomic_store_i32(volatile int32_t *value, int32_t desired) {
+    _ReadWriteBarrier();
+    *value = desired;
+}
+
+static inline int64_t atomic_load_i64(volatile int64_t *value) {
+    int64_t result = *value;
+    _ReadWriteBarrier();
+    return result;
+}
+
+static inline void atomic_store_i64(volatile int64_t *value, int64_t desired) {
+    _ReadWriteBarrier();
+    *value = desired;
+}
+
+static inline void *atomic_load_ptr(void *volatile *value) {
+    void *result = *value;
+    _ReadWriteBarrier();
+    return result;
+}
+
+static inline void atomic_store_ptr(void *volatile *value, void *desired) {
+    _ReadWriteBarrier();
+    *value = desired;
+}
+
+// NOTE: Returns the value before the add.
+static inline int32_t atomic_fetch_add_i32(volatile int32_t *value, int32_t add) {
+    return (int32_t)_InterlockedExchangeAdd((volatile long *)value, (long)add);
+}
+
+static inline bool atomic_cas_i64(volatile int64_t *value, int64_t expected, int64_t desired) {
+    return _InterlockedCompareExchange64((volatile long long *)value, desired, expected) ==
+           expected;
+}
+
+static inline void atomic_fence(void) {
+    _mm_mfence();
+}
+
+static inline void cpu_pause(void) {
+    _mm_pause();
+}
+#else
+#include <immintrin.h>
+
+static inline int32_t atomic_load_i32(volatile int32_t *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_i32(volatile int32_t *value, int32_t desired) {
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
+
+static inline int64_t atomic_load_i64(volatile int64_t *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_i64(volatile int64_t *value, int64_t desired) {
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
+
+static inline void *atomic_load_ptr(void *volatile *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_ptr(void *volatile *value, void *desired) {
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
+
+// NOTE: Returns the value before the add.
+static inline int32_t atomic_fetch_add_i32(volatile int32_t *value, int32_t add) {
+    return __atomic_fetch_add(value, add, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_cas_i64(volatile int64_t *value, int64_t expected, int64_t desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_fence(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void cpu_pause(void) {
+    _mm_pause();
+}
+#endif
+
+#endif // COMMON_H
@@ -0,0 +1,194 @@
+// NOTE: CPU frustum culling of bounding spheres. The bounds are stored as structure of arrays so
+// the SSE path tests 4 objects and the AVX2 path 8 objects per instruction against each plane. The
+// arrays are 32 byte aligned and padded to a multiple of CULL_LANES with spheres of negative
+// infinite radius, which always fail the test, so the wide paths never need a scalar tail. The
+// path is picked once at startup with SDL_HasAVX2/SDL_HasSSE2 and can be forced for benchmarks.
+
+#include <float.h>
+#include <immintrin.h>
+
+#define CULL_LANES 8
+#define CULL_PLANES_COUNT 6
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CULL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CULL_TARGET_AVX2
+#endif
+
+// NOTE: A point p is in front of the plane when dot(normal, p) + d >= 0.
+typedef struct CullPlane {
+    float x, y, z, d;
+} CullPlane;
+
+typedef struct CullBounds {
+    float *center_x;
+    float *center_y;
+    float *center_z;
+    float *radius;
+    unsigned int count;
+    unsigned int capacity;
+} CullBounds;
+
+typedef enum CullPath {
+    CULL_PATH_SCALAR,
+    CULL_PATH_SSE,
+    CULL_PATH_AVX2,
+} CullPath;
+
+const char *cull_path_names[] = { "scalar", "sse", "avx2" };
+
+CullBounds cull_bounds_create(Arena *arena, unsigned int capacity) {
+    CullBounds bounds = { 0 };
+    bounds.capacity   = (capacity + CULL_LANES - 1) & ~(CULL_LANES - 1);
+    bounds.center_x   = arena_push_no_zero(arena, bounds.capacity * sizeof(float), 32);
+    bounds.center_y   = arena_push_no_zero(arena, bounds.capacity * sizeof(float), 32);
+    bounds.center_z   = arena_push_no_zero(arena, bounds.capacity * sizeof(float), 32);
+    bounds.radius     = arena_push_no_zero(arena, bounds.capacity * sizeof(float), 32);
+    for(unsigned int i = 0; i < bounds.capacity; ++i) {
+        bounds.center_x[i] = 0.0f;
+        bounds.center_y[i] = 0.0f;
+        bounds.center_z[i] = 0.0f;
+        bounds.radius[i]   = -FLT_MAX;
+    }
+    return bounds;
+}
+
+unsigned int cull_bounds_push(CullBounds *bounds, float x, float y, float z, float radius) {
+    assert(bounds->count < bounds->capacity);
+    unsigned int index      = bounds->count++;
+    bounds->center_x[index] = x;
+    bounds->center_y[index] = y;
+    bounds->center_z[index] = z;
+    bounds->radius[index]   = radius;
+    return index;
+}
+
+// NOTE: visible needs room for bounds->capacity indices, the wide paths write whole lanes before
+// advancing the count.
+unsigned int cull_spheres_scalar(CullBounds *bounds, const CullPlane *planes,
+                                 unsigned int *visible) {
+    unsigned int visible_count = 0;
+    for(unsigned int i = 0; i < bounds->count; ++i) {
+        bool inside = true;
+        for(unsigned int plane_index = 0; plane_index < CULL_PLANES_COUNT; ++plane_index) {
+            const CullPlane *plane = &planes[plane_index];
+            float distance = plane->x * bounds->center_x[i] + plane->y * bounds->center_y[i] +
+                             plane->z * bounds->center_z[i] + plane->d;
+            inside &= distance >= -bounds->radius[i];
+        }
+        visible[visible_count] = i;
+        visible_count += inside;
+    }
+    return visible_count;
+}
+
+unsigned int cull_spheres_sse(CullBounds *bounds, const CullPlane *planes, unsigned int *visible) {
+    unsigned int visible_count = 0;
+    for(unsigned int i = 0; i < bounds->count; i += 4) {
+        __m128 x          = _mm_load_ps(bounds->center_x + i);
+        __m128 y          = _mm_load_ps(bounds->center_y + i);
+        __m128 z          = _mm_load_ps(bounds->center_z + i);
+        __m128 radius     = _mm_load_ps(bounds->radius + i);
+        __m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(unsigned int plane_index = 0; plane_index < CULL_PLANES_COUNT; ++plane_index) {
+            const CullPlane *plane = &planes[plane_index];
+            __m128 distance        = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane->x)),
+                                                _mm_mul_ps(y, _mm_set1_ps(plane->y)));
+            distance = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(plane->z)));
+            distance = _mm_add_ps(distance, _mm_set1_ps(plane->d));
+            inside   = _mm_and_ps(inside, _mm_cmpge_ps(distance, neg_radius));
+        }
+
+        // NOTE: Branchless compaction, every lane is written and only the visible ones are kept.
+        unsigned int mask = (unsigned int)_mm_movemask_ps(inside);
+        for(unsigned int lane = 0; lane < 4; ++lane) {
+            visible[visible_count] = i + lane;
+            visible_count += (mask >> lane) & 1;
+        }
+    }
+    return visible_count;
+}
+
+CULL_TARGET_AVX2
+unsigned int cull_spheres_avx2(CullBounds *bounds, const CullPlane *planes, unsigned int *visible) {
+    unsigned int visible_count = 0;
+    for(unsigned int i = 0; i < bounds->count; i += 8) {
+        __m256 x          = _mm256_load_ps(bounds->center_x + i);
+        __m256 y          = _mm256_load_ps(bounds->center_y + i);
+        __m256 z          = _mm256_load_ps(bounds->center_z + i);
+        __m256 radius     = _mm256_load_ps(bounds->radius + i);
+        __m256 neg_radius = _mm256_sub_ps(_mm256_setzero_ps(), radius);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(unsigned int plane_index = 0; plane_index < CULL_PLANES_COUNT; ++plane_index) {
+            const CullPlane *plane = &planes[plane_index];
+            __m256 distance        = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane->x)),
+                                                   _mm256_mul_ps(y, _mm256_set1_ps(plane->y)));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(z, _mm256_set1_ps(plane->z)));
+            distance = _mm256_add_ps(distance, _mm256_set1_ps(plane->d));
+            inside   = _mm256_and_ps(inside, _mm256_cmp_ps(distance, neg_radius, _CMP_GE_OQ));
+        }
+
+        unsigned int mask = (unsigned int)_mm256_movemask_ps(inside);
+        for(unsigned int lane = 0; lane < 8; ++lane) {
+            visible[visible_count] = i + lane;
+            visible_count += (mask >> lane) & 1;
+        }
+    }
+    return visible_count;
+}
+
+CullPath cull_best_path(void) {
+    if(SDL_HasAVX2()) {
+        return CULL_PATH_AVX2;
+    }
+    if(SDL_HasSSE2()) {
+        return CULL_PATH_SSE;
+    }
+    return CULL_PATH_SCALAR;
+}
+
+// NOTE: Writes the indices of the spheres that touch the frustum into visible, in ascending order,
+// and returns how many there are.
+unsigned int cull_spheres(CullPath path, CullBounds *bounds, const CullPlane *planes,
+                          unsigned int *visible) {
+    switch(path) {
+    case CULL_PATH_AVX2: {
+        return cull_spheres_avx2(bounds, planes, visible);
+    }
+    case CULL_PATH_SSE: {
+        return cull_spheres_sse(bounds, planes, visible);
+    }
+    default: {
+        return cull_spheres_scalar(bounds, planes, visible);
+    }
+    }
+}
+
+// NOTE: Culls the spheres in [first, first + count), so the bounds can be split between jobs.
+// first must be a multiple of CULL_LANES to keep the loads aligned, the indices written to visible
+// are still absolute and visible needs room for count indices rounded up to CULL_LANES.
+unsigned int cull_spheres_range(CullPath path, CullBounds *bounds, unsigned int first,
+                                unsigned int count, const CullPlane *planes,
+                                unsigned int *visible) {
+    assert((first & (CULL_LANES - 1)) == 0);
+    if(first >= bounds->count) {
+        return 0;
+    }
+    CullBounds range = *bounds;
+    range.center_x += first;
+    range.center_y += first;
+    range.center_z += first;
+    range.radius += first;
+    range.count    = min(count, bounds->count - first);
+    range.capacity = bounds->capacity - first;
+
+    unsigned int visible_count = cull_spheres(path, &range, planes, visible);
+    for(unsigned int i = 0; i < visible_count; ++i) {
+        visible[i] += first;
+    }
+    return visible_count;
+}
@@ -0,0 +1,157 @@
+// NOTE: Vulkan objects that may still be used by frames in flight are released into this queue
+// tagged with a frame number instead of being destroyed, and destroyed together once that frame
+// completed. Frame numbers only grow, so the queue is a FIFO ring and collecting stops at the
+// first entry whose frame isn't done yet. Anything that isn't a plain handle, like a swapchain
+// with its graph, goes in as a callback.
+
+#define DELETION_QUEUE_CAPACITY 4096
+
+typedef enum DeletionType {
+    DELETION_BUFFER,
+    DELETION_IMAGE,
+    DELETION_IMAGE_VIEW,
+    DELETION_FRAMEBUFFER,
+    DELETION_RENDER_PASS,
+    DELETION_PIPELINE,
+    DELETION_PIPELINE_LAYOUT,
+    DELETION_DESCRIPTOR_POOL,
+    DELETION_DESCRIPTOR_SET_LAYOUT,
+    DELETION_SWAPCHAIN,
+    DELETION_CALLBACK,
+} DeletionType;
+
+typedef void (*DeletionCallback)(void *data);
+
+// NOTE: Buffers and images take their allocation along, it is freed with them.
+typedef struct Deletion {
+    uint64_t frame;
+    DeletionType type;
+    union {
+        struct {
+            VkBuffer buffer;
+            GpuAllocation allocation;
+        } buffer;
+        struct {
+            VkImage image;
+            GpuAllocation allocation;
+        } image;
+        VkImageView image_view;
+        VkFramebuffer framebuffer;
+        VkRenderPass render_pass;
+        VkPipeline pipeline;
+        VkPipelineLayout pipeline_layout;
+        VkDescriptorPool descriptor_pool;
+        VkDescriptorSetLayout descriptor_set_layout;
+        VkSwapchainKHR swapchain;
+        struct {
+            DeletionCallback function;
+            void *data;
+        } callback;
+    };
+} Deletion;
+
+typedef struct DeletionQueue {
+    VkDevice device;
+    GpuAllocator *allocator;
+
+    // NOTE: head and tail only grow, the ring index is head % DELETION_QUEUE_CAPACITY.
+    Deletion *entries;
+    unsigned long long head;
+    unsigned long long tail;
+
+    unsigned long long destroyed_count;
+    unsigned long long max_pending;
+    unsigned long long collects_count;
+} DeletionQueue;
+
+void deletion_queue_create(DeletionQueue *queue, Arena *arena, VkDevice device,
+                           GpuAllocator *allocator) {
+    memset(queue, 0, sizeof(*queue));
+    queue->device    = device;
+    queue->allocator = allocator;
+    queue->entries   = arena_push_array(arena, Deletion, DELETION_QUEUE_CAPACITY);
+}
+
+static inline unsigned long long deletion_queue_pending(DeletionQueue *queue) {
+    return queue->head - queue->tail;
+}
+
+// NOTE: Returns false when the queue is full, the caller has to wait for frames to complete and
+// collect them before trying again. deletion.frame must not be lower than the last pushed one.
+bool deletion_queue_push(DeletionQueue *queue, Deletion deletion) {
+    if(deletion_queue_pending(queue) == DELETION_QUEUE_CAPACITY) {
+        return false;
+    }
+    assert(queue->head == queue->tail ||
+           queue->entries[(queue->head - 1) % DELETION_QUEUE_CAPACITY].frame <= deletion.frame);
+    queue->entries[queue->head++ % DELETION_QUEUE_CAPACITY] = deletion;
+    queue->max_pending = max(queue->max_pending, deletion_queue_pending(queue));
+    return true;
+}
+
+static void deletion_destroy(DeletionQueue *queue, Deletion *deletion) {
+    VkDevice device = queue->device;
+    switch(deletion->type) {
+    case DELETION_BUFFER: {
+        vkDestroyBuffer(device, deletion->buffer.buffer, NULL);
+        gpu_free(queue->allocator, &deletion->buffer.allocation);
+    } break;
+    case DELETION_IMAGE: {
+        vkDestroyImage(device, deletion->image.image, NULL);
+        gpu_free(queue->allocator, &deletion->image.allocation);
+    } break;
+    case DELETION_IMAGE_VIEW: {
+        vkDestroyImageView(device, deletion->image_view, NULL);
+    } break;
+    case DELETION_FRAMEBUFFER: {
+        vkDestroyFramebuffer(device, deletion->framebuffer, NULL);
+    } break;
+    case DELETION_RENDER_PASS: {
+        vkDestroyRenderPass(device, deletion->render_pass, NULL);
+    } break;
+    case DELETION_PIPELINE: {
+        vkDestroyPipeline(device, deletion->pipeline, NULL);
+    } break;
+    case DELETION_PIPELINE_LAYOUT: {
+        vkDestroyPipelineLayout(device, deletion->pipeline_layout, NULL);
+    } break;
+    case DELETION_DESCRIPTOR_POOL: {
+        vkDestroyDescriptorPool(device, deletion->descriptor_pool, NULL);
+    } break;
+    case DELETION_DESCRIPTOR_SET_LAYOUT: {
+        vkDestroyDescriptorSetLayout(device, deletion->descriptor_set_layout, NULL);
+    } break;
+    case DELETION_SWAPCHAIN: {
+        vkDestroySwapchainKHR(device, deletion->swapchain, NULL);
+    } break;
+    case DELETION_CALLBACK: {
+        deletion->callback.function(deletion->callback.data);
+    } break;
+    }
+}
+
+// NOTE: Destroys everything released for frames up to completed_frame, UINT64_MAX destroys all
+// of it once the device is idle.
+void deletion_queue_collect(DeletionQueue *queue, uint64_t completed_frame) {
+    unsigned long long destroyed = 0;
+    while(queue->tail < queue->head) {
+        Deletion *deletion = &queue->entries[queue->tail % DELETION_QUEUE_CAPACITY];
+        if(deletion->frame > completed_frame) {
+            break;
+        }
+        deletion_destroy(queue, deletion);
+        ++queue->tail;
+        ++destroyed;
+    }
+    if(destroyed > 0) {
+        queue->destroyed_count += destroyed;
+        ++queue->collects_count;
+    }
+}
+
+void deletion_queue_print_stats(DeletionQueue *queue) {
+    printf("deletion queue: %llu objects destroyed in %llu collects, %llu pending at most, "
+           "%llu left\n",
+           queue->destroyed_count, queue->collects_count, queue->max_pending,
+           deletion_queue_pending(queue));
+}
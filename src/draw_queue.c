@@ -0,0 +1,198 @@
+// NOTE: Draw packets sorted by a 64 bit state key. From the most to the least significant bits the
+// key holds the pass, the pipeline, the mesh and a depth bucket, so after sorting the draws of a
+// pass are grouped by pipeline, then by mesh, and front to back inside a mesh. Instances of a
+// material share its mesh, so the mesh index is what decides the vertex and index buffer binds.
+// The packets never move, only (key, packet index) pairs are sorted with an LSD radix sort, one
+// pass per byte of the key. A pass is skipped when every key has the same byte there, which is
+// the case for most of the key in a frame with a handful of pipelines and meshes. The sort is
+// stable so draws with equal keys keep their submission order.
+//
+// Issuing walks the sorted order and only binds the pipeline, vertex buffer or index buffer when
+// they differ from the previous draw.
+
+#define DRAW_KEY_PASS_BITS 8
+#define DRAW_KEY_PIPELINE_BITS 16
+#define DRAW_KEY_MESH_BITS 16
+#define DRAW_KEY_DEPTH_BITS 24
+#define DRAW_KEY_DEPTH_SHIFT 0
+#define DRAW_KEY_MESH_SHIFT (DRAW_KEY_DEPTH_SHIFT + DRAW_KEY_DEPTH_BITS)
+#define DRAW_KEY_PIPELINE_SHIFT (DRAW_KEY_MESH_SHIFT + DRAW_KEY_MESH_BITS)
+#define DRAW_KEY_PASS_SHIFT (DRAW_KEY_PIPELINE_SHIFT + DRAW_KEY_PIPELINE_BITS)
+#define DRAW_RADIX_PASSES 8
+
+typedef struct DrawPacket {
+    VkPipeline pipeline;
+    VkBuffer vertex_buffer;
+    VkBuffer index_buffer;
+    VkDeviceSize index_offset;
+    VkIndexType index_type;
+    uint32_t indices_count;
+    uint32_t first_instance;
+} DrawPacket;
+
+typedef struct DrawSortItem {
+    uint64_t key;
+    uint32_t packet;
+} DrawSortItem;
+
+typedef struct DrawQueue {
+    DrawPacket *packets;
+    DrawSortItem *items;
+    DrawSortItem *scratch;
+    uint32_t count;
+
+    // NOTE: Radix passes that actually moved data in the last sort, out of DRAW_RADIX_PASSES.
+    unsigned int passes_count;
+    // NOTE: Binds done by draw_queue_issue for the scene pass, which can run on several jobs at
+    // once. Walks with an override pipeline, like the depth prepass, aren't counted so the figure
+    // compares with draw_queue_count_binds whether the prepass is on or not.
+    volatile int32_t binds_count;
+} DrawQueue;
+
+static inline uint64_t draw_key(uint32_t pass, uint32_t pipeline, uint32_t mesh,
+                                uint32_t depth_bucket) {
+    assert(pass < (1u << DRAW_KEY_PASS_BITS));
+    assert(pipeline < (1u << DRAW_KEY_PIPELINE_BITS));
+    assert(mesh < (1u << DRAW_KEY_MESH_BITS));
+    assert(depth_bucket < (1u << DRAW_KEY_DEPTH_BITS));
+    return ((uint64_t)pass << DRAW_KEY_PASS_SHIFT) |
+           ((uint64_t)pipeline << DRAW_KEY_PIPELINE_SHIFT) |
+           ((uint64_t)mesh << DRAW_KEY_MESH_SHIFT) |
+           ((uint64_t)depth_bucket << DRAW_KEY_DEPTH_SHIFT);
+}
+
+// NOTE: depth is the view depth normalized to [0, 1], 0 being the nearest.
+static inline uint32_t draw_depth_bucket(float depth) {
+    float max_bucket = (float)((1u << DRAW_KEY_DEPTH_BITS) - 1);
+    return (uint32_t)(clamp(depth, 0.0f, 1.0f) * max_bucket);
+}
+
+// NOTE: Makes room for count draws on the arena, every slot must then be filled with
+// draw_queue_set. Slots are independent so they can be filled from several jobs.
+void draw_queue_begin(DrawQueue *queue, Arena *arena, uint32_t count) {
+    queue->packets      = arena_push_array_no_zero(arena, DrawPacket, count);
+    queue->items        = arena_push_array_no_zero(arena, DrawSortItem, count);
+    queue->scratch      = arena_push_array_no_zero(arena, DrawSortItem, count);
+    queue->count        = count;
+    queue->passes_count = 0;
+    atomic_store_i32(&queue->binds_count, 0);
+}
+
+static inline void draw_queue_set(DrawQueue *queue, uint32_t index, uint64_t key,
+                                  DrawPacket *packet) {
+    assert(index < queue->count);
+    queue->packets[index]      = *packet;
+    queue->items[index].key    = key;
+    queue->items[index].packet = index;
+}
+
+// NOTE: Sorts items by key, the result ends up in items and scratch is clobbered. All the byte
+// histograms are built in a single read of the keys. Returns how many passes moved data.
+unsigned int draw_radix_sort(DrawSortItem *items, DrawSortItem *scratch, uint32_t count) {
+    uint32_t histograms[DRAW_RADIX_PASSES][256];
+    memset(histograms, 0, sizeof(histograms));
+    for(uint32_t i = 0; i < count; ++i) {
+        uint64_t key = items[i].key;
+        for(unsigned int pass = 0; pass < DRAW_RADIX_PASSES; ++pass) {
+            ++histograms[pass][(key >> (pass * 8)) & 0xff];
+        }
+    }
+
+    unsigned int passes_count = 0;
+    DrawSortItem *src         = items;
+    DrawSortItem *dst         = scratch;
+    for(unsigned int pass = 0; pass < DRAW_RADIX_PASSES; ++pass) {
+        uint32_t *histogram = histograms[pass];
+        if(count == 0 || histogram[(src[0].key >> (pass * 8)) & 0xff] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for(unsigned int digit = 0; digit < 256; ++digit) {
+            uint32_t digit_count = histogram[digit];
+            histogram[digit]     = offset;
+            offset += digit_count;
+        }
+        for(uint32_t i = 0; i < count; ++i) {
+            dst[histogram[(src[i].key >> (pass * 8)) & 0xff]++] = src[i];
+        }
+
+        DrawSortItem *tmp = src;
+        src               = dst;
+        dst               = tmp;
+        ++passes_count;
+    }
+    if(src != items) {
+        memcpy(items, src, count * sizeof(DrawSortItem));
+    }
+    return passes_count;
+}
+
+void draw_queue_sort(DrawQueue *queue) {
+    queue->passes_count = draw_radix_sort(queue->items, queue->scratch, queue->count);
+}
+
+static inline DrawPacket *draw_queue_get(DrawQueue *queue, uint32_t index) {
+    return &queue->packets[queue->items[index].packet];
+}
+
+// NOTE: The binds a walk over the queue needs in its current order, submission order until it is
+// sorted. Used to report what sorting saves without recording anything.
+uint32_t draw_queue_count_binds(DrawQueue *queue) {
+    uint32_t binds_count      = 0;
+    VkPipeline pipeline       = VK_NULL_HANDLE;
+    VkBuffer vertex_buffer    = VK_NULL_HANDLE;
+    VkBuffer index_buffer     = VK_NULL_HANDLE;
+    VkDeviceSize index_offset = 0;
+    for(uint32_t i = 0; i < queue->count; ++i) {
+        DrawPacket *packet = draw_queue_get(queue, i);
+        binds_count += packet->pipeline != pipeline;
+        binds_count += packet->vertex_buffer != vertex_buffer;
+        binds_count +=
+            packet->index_buffer != index_buffer || packet->index_offset != index_offset;
+        pipeline      = packet->pipeline;
+        vertex_buffer = packet->vertex_buffer;
+        index_buffer  = packet->index_buffer;
+        index_offset  = packet->index_offset;
+    }
+    return binds_count;
+}
+
+// NOTE: Records the draws [first, first + count) of the queue. Nothing is assumed to be bound on
+// entry besides the dynamic state and the per instance vertex buffer at binding 1. A pipeline
+// other than VK_NULL_HANDLE replaces the one of every packet, for passes like the depth prepass
+// that draw the same list with their own pipeline.
+void draw_queue_issue(DrawQueue *queue, VkCommandBuffer command_buffer, uint32_t first,
+                      uint32_t count, VkPipeline override_pipeline) {
+    uint32_t binds_count      = 0;
+    VkPipeline pipeline       = VK_NULL_HANDLE;
+    VkBuffer vertex_buffer    = VK_NULL_HANDLE;
+    VkBuffer index_buffer     = VK_NULL_HANDLE;
+    VkDeviceSize index_offset = 0;
+    for(uint32_t i = first; i < first + count; ++i) {
+        DrawPacket *packet         = draw_queue_get(queue, i);
+        VkPipeline packet_pipeline = override_pipeline != VK_NULL_HANDLE ? override_pipeline
+                                                                         : packet->pipeline;
+        if(packet_pipeline != pipeline) {
+            pipeline = packet_pipeline;
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            ++binds_count;
+        }
+        if(packet->vertex_buffer != vertex_buffer) {
+            VkDeviceSize offset = 0;
+            vertex_buffer       = packet->vertex_buffer;
+            vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertex_buffer, &offset);
+            ++binds_count;
+        }
+        if(packet->index_buffer != index_buffer || packet->index_offset != index_offset) {
+            index_buffer = packet->index_buffer;
+            index_offset = packet->index_offset;
+            vkCmdBindIndexBuffer(command_buffer, index_buffer, index_offset, packet->index_type);
+            ++binds_count;
+        }
+        vkCmdDrawIndexed(command_buffer, packet->indices_count, 1, 0, 0, packet->first_instance);
+    }
+    if(override_pipeline == VK_NULL_HANDLE) {
+        atomic_fetch_add_i32(&queue->binds_count, (int32_t)binds_count);
+    }
+}
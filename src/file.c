@@ -0,0 +1,111 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef struct File {
+    void *data;
+    size_t size;
+} File;
+
+File read_entire_file(Arena *arena, const char *path) {
+    File result = { 0 };
+    FILE *file  = fopen(path, "rb");
+    if(file == NULL) {
+        printf("Failed to open file: %s\n", path);
+        return result;
+    }
+#if defined(_WIN32)
+    _fseeki64(file, 0, SEEK_END);
+    size_t size = (size_t)_ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+#else
+    fseeko(file, 0, SEEK_END);
+    size_t size = (size_t)ftello(file);
+    fseeko(file, 0, SEEK_SET);
+#endif
+    result.data = arena_push_no_zero(arena, size + 1, 1);
+    result.size = size;
+    fread(result.data, result.size, 1, file);
+    ((unsigned char *)result.data)[result.size] = '\0';
+    fclose(file);
+    return result;
+}
+
+// NOTE: Read only memory mapped file. The data comes straight from the page cache, nothing is
+// copied and the pages are only read from disk when touched. Views handed out with file_view stay
+// valid until file_unmap is called. The base address is page aligned, so it can be consumed
+// directly as SPIR-V or vertex data.
+typedef struct FileMapping {
+    void *data;
+    size_t size;
+} FileMapping;
+
+FileMapping file_map(const char *path) {
+    FileMapping mapping = { 0 };
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE) {
+        printf("Failed to open file: %s\n", path);
+        return mapping;
+    }
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    if(file_size.QuadPart > 0) {
+        // NOTE: The view keeps the mapping alive, both handles can be closed right away.
+        HANDLE file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(file_mapping != NULL) {
+            mapping.data = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+            mapping.size = mapping.data ? (size_t)file_size.QuadPart : 0;
+            CloseHandle(file_mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        printf("Failed to open file: %s\n", path);
+        return mapping;
+    }
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        void *data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            madvise(data, (size_t)file_stat.st_size, MADV_WILLNEED);
+            mapping.data = data;
+            mapping.size = (size_t)file_stat.st_size;
+        }
+    }
+    close(fd);
+#endif
+
+    return mapping;
+}
+
+void file_unmap(FileMapping *mapping) {
+    if(mapping->data) {
+#if defined(_WIN32)
+        UnmapViewOfFile(mapping->data);
+#else
+        munmap(mapping->data, mapping->size);
+#endif
+    }
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+File file_view(FileMapping *mapping, size_t offset, size_t size) {
+    assert(offset + size <= mapping->size);
+    File result = { 0 };
+    result.data = (unsigned char *)mapping->data + offset;
+    result.size = size;
+    return result;
+}
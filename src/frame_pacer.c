@@ -0,0 +1,135 @@
+// NOTE: Frame rate limiter. Every frame starts on a fixed deadline grid of 1 / target_fps. The
+// wait until the deadline sleeps for most of it and spins with cpu_pause for the rest, since a
+// sleep can wake up late by up to the scheduler's granularity but a spin is exact. The spin part
+// (the slack) adapts to how late the sleeps of this machine actually wake up, so most of the wait
+// is spent asleep. SDL_GetPerformanceCounter is QPC on Windows and CLOCK_MONOTONIC_RAW on Linux
+// when the kernel has it, CLOCK_MONOTONIC otherwise. SDL sets the Windows timer resolution to
+// 1 ms, so SDL_Delay is precise to about a millisecond on both.
+//
+// Frame times are the time between frame starts, their mean and variance are kept with Welford's
+// online algorithm so the jitter can be reported without storing every frame.
+
+#define FRAME_PACER_INITIAL_SLACK_MS 2.0
+#define FRAME_PACER_MIN_SLACK_MS 0.25
+// NOTE: The slack shrinks by 1 / FRAME_PACER_SLACK_DECAY of the difference per sleep that woke
+// up earlier than it, and grows straight to any sleep that woke up later.
+#define FRAME_PACER_SLACK_DECAY 16
+
+typedef struct FramePacer {
+    double frequency;
+    // NOTE: Ticks per frame, 0 doesn't limit and only measures.
+    Uint64 period;
+    Uint64 deadline;
+    Uint64 last_frame;
+    Uint64 slack;
+    Uint64 min_slack;
+
+    unsigned long long frames_count;
+    unsigned long long missed_count;
+    double mean_ms;
+    double m2;
+    double min_ms;
+    double max_ms;
+    double sleep_ms_total;
+    double spin_ms_total;
+} FramePacer;
+
+static inline double frame_pacer_ms(FramePacer *pacer, Uint64 ticks) {
+    return (double)ticks * 1000.0 / pacer->frequency;
+}
+
+static inline Uint64 frame_pacer_ticks(FramePacer *pacer, double ms) {
+    return (Uint64)(ms * pacer->frequency / 1000.0);
+}
+
+// NOTE: target_fps of 0 runs unlimited.
+void frame_pacer_init(FramePacer *pacer, unsigned int target_fps) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->frequency = (double)SDL_GetPerformanceFrequency();
+    pacer->period    = target_fps > 0 ? (Uint64)(pacer->frequency / target_fps) : 0;
+    pacer->slack     = frame_pacer_ticks(pacer, FRAME_PACER_INITIAL_SLACK_MS);
+    pacer->min_slack = frame_pacer_ticks(pacer, FRAME_PACER_MIN_SLACK_MS);
+    pacer->min_ms    = 1e30;
+}
+
+static void frame_pacer_sleep_until(FramePacer *pacer, Uint64 deadline) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    while(now + pacer->slack < deadline) {
+        Uint64 request = deadline - pacer->slack - now;
+        Uint32 ms      = (Uint32)frame_pacer_ms(pacer, request);
+        if(ms == 0) {
+            break;
+        }
+        SDL_Delay(ms);
+        Uint64 woke  = SDL_GetPerformanceCounter();
+        Uint64 slept = woke - now;
+        pacer->sleep_ms_total += frame_pacer_ms(pacer, slept);
+
+        Uint64 requested = frame_pacer_ticks(pacer, (double)ms);
+        Uint64 late      = slept > requested ? slept - requested : 0;
+        if(late > pacer->slack) {
+            pacer->slack = late;
+        } else {
+            pacer->slack -= (pacer->slack - late) / FRAME_PACER_SLACK_DECAY;
+        }
+        pacer->slack = max(pacer->slack, pacer->min_slack);
+        now          = woke;
+    }
+
+    Uint64 spin_start = now;
+    while(now < deadline) {
+        cpu_pause();
+        now = SDL_GetPerformanceCounter();
+    }
+    pacer->spin_ms_total += frame_pacer_ms(pacer, now - spin_start);
+}
+
+// NOTE: Call once at the start of every frame, returns when the frame may start.
+void frame_pacer_wait(FramePacer *pacer) {
+    if(pacer->period > 0 && pacer->deadline > 0) {
+        frame_pacer_sleep_until(pacer, pacer->deadline);
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    if(pacer->period > 0 && pacer->deadline == 0) {
+        pacer->deadline = now + pacer->period;
+    } else if(pacer->period > 0) {
+        // NOTE: A late frame moves the grid instead of rushing the next frames to catch up.
+        pacer->deadline += pacer->period;
+        if(pacer->deadline < now) {
+            pacer->deadline = now + pacer->period;
+            ++pacer->missed_count;
+        }
+    }
+
+    if(pacer->last_frame > 0) {
+        double frame_ms = frame_pacer_ms(pacer, now - pacer->last_frame);
+        ++pacer->frames_count;
+        double delta = frame_ms - pacer->mean_ms;
+        pacer->mean_ms += delta / (double)pacer->frames_count;
+        pacer->m2 += delta * (frame_ms - pacer->mean_ms);
+        pacer->min_ms = min(pacer->min_ms, frame_ms);
+        pacer->max_ms = max(pacer->max_ms, frame_ms);
+    }
+    pacer->last_frame = now;
+}
+
+double frame_pacer_stddev_ms(FramePacer *pacer) {
+    if(pacer->frames_count < 2) {
+        return 0.0;
+    }
+    return sqrt(pacer->m2 / (double)(pacer->frames_count - 1));
+}
+
+void frame_pacer_print_stats(FramePacer *pacer) {
+    if(pacer->frames_count == 0) {
+        return;
+    }
+    double waited_ms = pacer->sleep_ms_total + pacer->spin_ms_total;
+    printf("pacing: target %.1f fps, %.3f ms/frame avg, %.3f ms stddev, %.3f ms min, "
+           "%.3f ms max, %llu missed, %.1f%% of the wait asleep (%.3f ms slack)\n",
+           pacer->period > 0 ? pacer->frequency / (double)pacer->period : 0.0, pacer->mean_ms,
+           frame_pacer_stddev_ms(pacer), pacer->min_ms, pacer->max_ms, pacer->missed_count,
+           waited_ms > 0.0 ? pacer->sleep_ms_total * 100.0 / waited_ms : 0.0,
+           frame_pacer_ms(pacer, pacer->slack));
+}
@@ -0,0 +1,370 @@
+// NOTE: Device memory sub-allocator. Large VkDeviceMemory blocks are allocated per memory type
+// and split into aligned ranges with a sorted, coalescing free list. This keeps the number of
+// vkAllocateMemory calls far below maxMemoryAllocationCount no matter how many buffers we create.
+
+#define GPU_BLOCK_SIZE mb(64)
+#define GPU_MAX_BLOCKS 256
+#define GPU_NODES_ARENA_SIZE mb(64)
+
+typedef struct GpuFreeRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    struct GpuFreeRange *next;
+} GpuFreeRange;
+
+typedef struct GpuBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    unsigned int memory_type;
+    unsigned int allocations_count;
+    bool dedicated;
+    void *mapped;
+    GpuFreeRange *free_list;
+} GpuBlock;
+
+typedef struct GpuAllocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped;
+    unsigned int block_index;
+} GpuAllocation;
+
+typedef struct GpuAllocatorStats {
+    unsigned int blocks_count;
+    unsigned int live_allocations;
+    VkDeviceSize bytes_reserved;
+    VkDeviceSize bytes_used;
+    VkDeviceSize bytes_free;
+    VkDeviceSize largest_free_range;
+    float fragmentation;
+} GpuAllocatorStats;
+
+typedef struct GpuAllocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_props;
+    VkDeviceSize buffer_image_granularity;
+    unsigned int max_allocations_count;
+
+    Arena nodes_arena;
+    GpuFreeRange *free_nodes;
+
+    GpuBlock blocks[GPU_MAX_BLOCKS];
+    unsigned int blocks_count;
+    unsigned int device_allocations_count;
+    unsigned int live_allocations;
+} GpuAllocator;
+
+static inline VkDeviceSize gpu_align_up(VkDeviceSize value, VkDeviceSize align) {
+    assert(is_power_of_two(align));
+    return (value + (align - 1)) & ~(align - 1);
+}
+
+void gpu_allocator_init(GpuAllocator *allocator, VkPhysicalDevice physical_device,
+                        VkDevice device) {
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->device      = device;
+    allocator->nodes_arena = arena_create_virtual(GPU_NODES_ARENA_SIZE, 0);
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->memory_props);
+
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(physical_device, &device_props);
+    allocator->buffer_image_granularity = device_props.limits.bufferImageGranularity;
+    allocator->max_allocations_count    = device_props.limits.maxMemoryAllocationCount;
+}
+
+unsigned int find_memory_type(GpuAllocator *allocator, uint32_t filter,
+                              VkMemoryPropertyFlags properties) {
+    VkPhysicalDeviceMemoryProperties *mem_properties = &allocator->memory_props;
+    for(uint32_t i = 0; i < mem_properties->memoryTypeCount; i++) {
+        if((filter & (1 << i)) &&
+           (mem_properties->memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    printf("Failed to find suitable memory type!\n");
+    exit(1);
+}
+
+static GpuFreeRange *gpu_free_range_create(GpuAllocator *allocator, VkDeviceSize offset,
+                                           VkDeviceSize size, GpuFreeRange *next) {
+    GpuFreeRange *range = allocator->free_nodes;
+    if(range) {
+        allocator->free_nodes = range->next;
+    } else {
+        range = (GpuFreeRange *)arena_push(&allocator->nodes_arena, sizeof(GpuFreeRange), 8);
+    }
+    range->offset = offset;
+    range->size   = size;
+    range->next   = next;
+    return range;
+}
+
+static void gpu_free_range_release(GpuAllocator *allocator, GpuFreeRange *range) {
+    range->next           = allocator->free_nodes;
+    allocator->free_nodes = range;
+}
+
+static unsigned int gpu_block_create(GpuAllocator *allocator, unsigned int memory_type,
+                                     VkDeviceSize size, bool dedicated) {
+    unsigned int block_index = allocator->blocks_count;
+    for(unsigned int i = 0; i < allocator->blocks_count; ++i) {
+        if(allocator->blocks[i].memory == VK_NULL_HANDLE) {
+            block_index = i;
+            break;
+        }
+    }
+
+    if(block_index == GPU_MAX_BLOCKS ||
+       allocator->device_allocations_count >= allocator->max_allocations_count) {
+        printf("Out of device memory blocks!\n");
+        exit(1);
+    }
+
+    VkMemoryAllocateInfo alloc_info = { 0 };
+    alloc_info.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize       = size;
+    alloc_info.memoryTypeIndex      = memory_type;
+
+    GpuBlock *block = &allocator->blocks[block_index];
+    memset(block, 0, sizeof(*block));
+    if(vkAllocateMemory(allocator->device, &alloc_info, NULL, &block->memory) != VK_SUCCESS) {
+        printf("Failed to allocate device memory block!\n");
+        exit(1);
+    }
+
+    block->size        = size;
+    block->memory_type = memory_type;
+    block->dedicated   = dedicated;
+    block->free_list   = gpu_free_range_create(allocator, 0, size, NULL);
+
+    // NOTE: Host visible blocks stay mapped for their whole life, a VkDeviceMemory can only be
+    // mapped once so the sub-allocations hand out pointers into this single mapping.
+    VkMemoryPropertyFlags flags = allocator->memory_props.memoryTypes[memory_type].propertyFlags;
+    if(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(allocator->device, block->memory, 0, size, 0, &block->mapped);
+    }
+
+    if(block_index == allocator->blocks_count) {
+        ++allocator->blocks_count;
+    }
+    ++allocator->device_allocations_count;
+    return block_index;
+}
+
+static void gpu_block_destroy(GpuAllocator *allocator, GpuBlock *block) {
+    if(block->mapped) {
+        vkUnmapMemory(allocator->device, block->memory);
+    }
+    vkFreeMemory(allocator->device, block->memory, NULL);
+    while(block->free_list) {
+        GpuFreeRange *next = block->free_list->next;
+        gpu_free_range_release(allocator, block->free_list);
+        block->free_list = next;
+    }
+    memset(block, 0, sizeof(*block));
+    --allocator->device_allocations_count;
+}
+
+static bool gpu_block_alloc(GpuAllocator *allocator, GpuBlock *block, VkDeviceSize size,
+                            VkDeviceSize align, VkDeviceSize *offset) {
+    GpuFreeRange **link = &block->free_list;
+    while(*link) {
+        GpuFreeRange *range         = *link;
+        VkDeviceSize aligned        = gpu_align_up(range->offset, align);
+        VkDeviceSize range_end      = range->offset + range->size;
+        VkDeviceSize allocation_end = aligned + size;
+
+        if(allocation_end <= range_end) {
+            // NOTE: Split the range in (padding, allocation, tail) and keep what is left free.
+            VkDeviceSize padding = aligned - range->offset;
+            VkDeviceSize tail    = range_end - allocation_end;
+            if(padding > 0 && tail > 0) {
+                range->size = padding;
+                range->next = gpu_free_range_create(allocator, allocation_end, tail, range->next);
+            } else if(padding > 0) {
+                range->size = padding;
+            } else if(tail > 0) {
+                range->offset = allocation_end;
+                range->size   = tail;
+            } else {
+                *link = range->next;
+                gpu_free_range_release(allocator, range);
+            }
+
+            block->used += size;
+            ++block->allocations_count;
+            *offset = aligned;
+            return true;
+        }
+        link = &range->next;
+    }
+    return false;
+}
+
+GpuAllocation gpu_alloc(GpuAllocator *allocator, VkMemoryRequirements *mem_req,
+                        VkMemoryPropertyFlags properties) {
+    unsigned int memory_type = find_memory_type(allocator, mem_req->memoryTypeBits, properties);
+
+    // NOTE: Aligning every range to bufferImageGranularity lets linear and optimal resources
+    // share a block without tracking what lives next to each allocation.
+    VkDeviceSize align = mem_req->alignment;
+    if(allocator->buffer_image_granularity > align) {
+        align = allocator->buffer_image_granularity;
+    }
+    VkDeviceSize size = gpu_align_up(mem_req->size, align);
+
+    // NOTE: Small heaps (e.g. the 256MB BAR heap) get smaller blocks so we don't eat them whole.
+    unsigned int heap_index = allocator->memory_props.memoryTypes[memory_type].heapIndex;
+    VkDeviceSize block_size = GPU_BLOCK_SIZE;
+    VkDeviceSize heap_size  = allocator->memory_props.memoryHeaps[heap_index].size;
+    while(block_size > mb(1) && block_size > heap_size / 8) {
+        block_size /= 2;
+    }
+
+    GpuAllocation allocation = { 0 };
+    allocation.size          = size;
+
+    if(size > block_size / 2) {
+        unsigned int block_index = gpu_block_create(allocator, memory_type, size, true);
+        GpuBlock *block          = &allocator->blocks[block_index];
+        gpu_block_alloc(allocator, block, size, align, &allocation.offset);
+        allocation.block_index = block_index;
+    } else {
+        bool found = false;
+        for(unsigned int block_index = 0; block_index < allocator->blocks_count; ++block_index) {
+            GpuBlock *block = &allocator->blocks[block_index];
+            if(block->memory == VK_NULL_HANDLE || block->dedicated ||
+               block->memory_type != memory_type || block->size - block->used < size) {
+                continue;
+            }
+            if(gpu_block_alloc(allocator, block, size, align, &allocation.offset)) {
+                allocation.block_index = block_index;
+                found                  = true;
+                break;
+            }
+        }
+
+        if(!found) {
+            unsigned int block_index = gpu_block_create(allocator, memory_type, block_size, false);
+            gpu_block_alloc(allocator, &allocator->blocks[block_index], size, align,
+                            &allocation.offset);
+            allocation.block_index = block_index;
+        }
+    }
+
+    GpuBlock *block   = &allocator->blocks[allocation.block_index];
+    allocation.memory = block->memory;
+    allocation.mapped = block->mapped ? (unsigned char *)block->mapped + allocation.offset : NULL;
+    ++allocator->live_allocations;
+    return allocation;
+}
+
+void gpu_free(GpuAllocator *allocator, GpuAllocation *allocation) {
+    if(allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    GpuBlock *block = &allocator->blocks[allocation->block_index];
+    assert(block->memory == allocation->memory);
+
+    block->used -= allocation->size;
+    --block->allocations_count;
+    --allocator->live_allocations;
+
+    if(block->dedicated) {
+        gpu_block_destroy(allocator, block);
+        memset(allocation, 0, sizeof(*allocation));
+        return;
+    }
+
+    // NOTE: Insert the range sorted by offset and merge it with its neighbours.
+    VkDeviceSize offset = allocation->offset;
+    VkDeviceSize end    = allocation->offset + allocation->size;
+    GpuFreeRange *prev  = NULL;
+    GpuFreeRange *next  = block->free_list;
+    while(next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+
+    bool merge_prev = prev && prev->offset + prev->size == offset;
+    bool merge_next = next && next->offset == end;
+    if(merge_prev && merge_next) {
+        prev->size += allocation->size + next->size;
+        prev->next = next->next;
+        gpu_free_range_release(allocator, next);
+    } else if(merge_prev) {
+        prev->size += allocation->size;
+    } else if(merge_next) {
+        next->offset = offset;
+        next->size += allocation->size;
+    } else {
+        GpuFreeRange *range = gpu_free_range_create(allocator, offset, allocation->size, next);
+        if(prev) {
+            prev->next = range;
+        } else {
+            block->free_list = range;
+        }
+    }
+
+    memset(allocation, 0, sizeof(*allocation));
+}
+
+void gpu_allocator_destroy(GpuAllocator *allocator) {
+    for(unsigned int block_index = 0; block_index < allocator->blocks_count; ++block_index) {
+        GpuBlock *block = &allocator->blocks[block_index];
+        if(block->memory != VK_NULL_HANDLE) {
+            gpu_block_destroy(allocator, block);
+        }
+    }
+    allocator->blocks_count = 0;
+    arena_destroy(&allocator->nodes_arena);
+}
+
+GpuAllocatorStats gpu_allocator_get_stats(GpuAllocator *allocator) {
+    GpuAllocatorStats stats = { 0 };
+    stats.live_allocations  = allocator->live_allocations;
+    VkDeviceSize splintered = 0;
+
+    for(unsigned int block_index = 0; block_index < allocator->blocks_count; ++block_index) {
+        GpuBlock *block = &allocator->blocks[block_index];
+        if(block->memory == VK_NULL_HANDLE) {
+            continue;
+        }
+        ++stats.blocks_count;
+        stats.bytes_reserved += block->size;
+        stats.bytes_used += block->used;
+
+        VkDeviceSize block_free = 0, block_largest = 0;
+        for(GpuFreeRange *range = block->free_list; range; range = range->next) {
+            block_free += range->size;
+            if(range->size > block_largest) {
+                block_largest = range->size;
+            }
+        }
+        stats.bytes_free += block_free;
+        splintered += block_free - block_largest;
+        if(block_largest > stats.largest_free_range) {
+            stats.largest_free_range = block_largest;
+        }
+    }
+
+    // NOTE: Fraction of the free memory that is not part of its block's largest free range.
+    // 0 means every block has its free space in one piece, 1 means it is all splinters.
+    if(stats.bytes_free > 0) {
+        stats.fragmentation = (float)((double)splintered / (double)stats.bytes_free);
+    }
+    return stats;
+}
+
+void gpu_allocator_print_stats(GpuAllocator *allocator) {
+    GpuAllocatorStats stats = gpu_allocator_get_stats(allocator);
+    printf("gpu memory: %u allocations in %u blocks, used %.2f MB / reserved %.2f MB, "
+           "largest free %.2f MB, fragmentation %.1f%%\n",
+           stats.live_allocations, stats.blocks_count, (double)stats.bytes_used / mb(1),
+           (double)stats.bytes_reserved / mb(1), (double)stats.largest_free_range / mb(1),
+           stats.fragmentation * 100.0f);
+}
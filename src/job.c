@@ -0,0 +1,336 @@
+// NOTE: Work stealing job system. Every worker owns a Chase-Lev deque: the owner pushes and pops
+// jobs at the bottom without locking and the other workers steal from the top with a CAS, so the
+// only contention is between thieves racing for the same job. Worker 0 is the thread that called
+// job_system_init (the main thread), it never sleeps and runs jobs whenever it waits on a counter.
+// The other workers spin for a while when they run out of work and then sleep on a semaphore that
+// is posted when jobs are pushed.
+//
+// Dependencies are expressed with counters: job_submit adds the job to a counter and the counter
+// drops back when the job finished, job_wait runs other jobs until it reaches zero. A job can wait
+// on the counters of the jobs it spawned, the worker keeps executing jobs in the meantime.
+//
+// Jobs can only be submitted from worker threads, and no more than JOB_DEQUE_SIZE jobs can be
+// queued on a worker at once. The deque holds the jobs by value, so a slot is free again as soon
+// as its job was taken and a job that is still queued is never overwritten.
+
+#define JOB_MAX_WORKERS 16
+#define JOB_DEQUE_SIZE 4096
+#define JOB_SPIN_COUNT 256
+#define JOB_SLEEP_TIMEOUT_MS 10
+// NOTE: job_parallel_for makes at most this many batches per worker so a slow batch can be
+// balanced out by the others.
+#define JOB_BATCHES_PER_WORKER 4
+
+#if defined(_MSC_VER)
+#define JOB_THREAD_LOCAL __declspec(thread)
+#else
+#define JOB_THREAD_LOCAL _Thread_local
+#endif
+
+// NOTE: Runs the job over the items [first, first + count), single jobs get whatever range they
+// were submitted with.
+typedef void JobFunc(void *data, unsigned int first, unsigned int count);
+
+typedef struct JobCounter {
+    volatile int32_t value;
+} JobCounter;
+
+typedef struct Job {
+    JobFunc *func;
+    void *data;
+    unsigned int first;
+    unsigned int count;
+    JobCounter *counter;
+} Job;
+
+// NOTE: top and bottom live on their own cache lines, the owner writes bottom on every push and
+// pop while the thieves hammer top. A thief copies the job out before its CAS on top, the copy is
+// only used when the CAS succeeds, which means the owner hasn't reused the slot in the meantime.
+typedef struct JobDeque {
+    volatile int64_t top;
+    char top_padding[64 - sizeof(int64_t)];
+    volatile int64_t bottom;
+    char bottom_padding[64 - sizeof(int64_t)];
+    Job jobs[JOB_DEQUE_SIZE];
+} JobDeque;
+
+struct JobSystem;
+
+typedef struct JobWorker {
+    JobDeque deque;
+    uint32_t random;
+    struct JobSystem *system;
+    unsigned int index;
+    SDL_Thread *thread;
+
+    // NOTE: Only written by the worker itself, read once the workers stopped.
+    uint64_t executed_count;
+    uint64_t stolen_count;
+    uint64_t sleep_count;
+} JobWorker;
+
+typedef struct JobSystem {
+    JobWorker workers[JOB_MAX_WORKERS];
+    unsigned int workers_count;
+    volatile int32_t quit;
+    volatile int32_t sleeping;
+    SDL_sem *wake;
+} JobSystem;
+
+static JOB_THREAD_LOCAL JobWorker *job_current_worker;
+
+// NOTE: The release store of bottom publishes the job written before it.
+static void job_deque_push(JobDeque *deque, Job job) {
+    int64_t bottom = atomic_load_i64(&deque->bottom);
+    int64_t top    = atomic_load_i64(&deque->top);
+    if(bottom - top >= JOB_DEQUE_SIZE) {
+        printf("Job deque overflow!\n");
+        exit(1);
+    }
+    deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)] = job;
+    atomic_store_i64(&deque->bottom, bottom + 1);
+}
+
+// NOTE: Owner only. bottom is published before top is read so a thief and the owner can't both
+// take the last job, when only one job is left they race for it on top.
+static bool job_deque_pop(JobDeque *deque, Job *job) {
+    int64_t bottom = atomic_load_i64(&deque->bottom) - 1;
+    atomic_store_i64(&deque->bottom, bottom);
+    atomic_fence();
+    int64_t top = atomic_load_i64(&deque->top);
+
+    if(top > bottom) {
+        atomic_store_i64(&deque->bottom, bottom + 1);
+        return false;
+    }
+    *job       = deque->jobs[bottom & (JOB_DEQUE_SIZE - 1)];
+    bool taken = true;
+    if(top == bottom) {
+        taken = atomic_cas_i64(&deque->top, top, top + 1);
+        atomic_store_i64(&deque->bottom, bottom + 1);
+    }
+    return taken;
+}
+
+static bool job_deque_steal(JobDeque *deque, Job *job) {
+    int64_t top = atomic_load_i64(&deque->top);
+    atomic_fence();
+    int64_t bottom = atomic_load_i64(&deque->bottom);
+    if(top >= bottom) {
+        return false;
+    }
+    *job = deque->jobs[top & (JOB_DEQUE_SIZE - 1)];
+    return atomic_cas_i64(&deque->top, top, top + 1);
+}
+
+static uint32_t job_random(JobWorker *worker) {
+    uint32_t x = worker->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker->random = x;
+    return x;
+}
+
+// NOTE: The worker's own jobs first, newest first since their data is most likely still in cache,
+// then the oldest job of the other workers starting from a random one.
+static bool job_find(JobSystem *system, JobWorker *worker, Job *job) {
+    if(job_deque_pop(&worker->deque, job)) {
+        return true;
+    }
+    if(system->workers_count == 1) {
+        return false;
+    }
+    unsigned int start = job_random(worker) % system->workers_count;
+    for(unsigned int i = 0; i < system->workers_count; ++i) {
+        JobWorker *victim = &system->workers[(start + i) % system->workers_count];
+        if(victim == worker) {
+            continue;
+        }
+        if(job_deque_steal(&victim->deque, job)) {
+            ++worker->stolen_count;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void job_execute(JobWorker *worker, Job *job) {
+    job->func(job->data, job->first, job->count);
+    ++worker->executed_count;
+    if(job->counter != NULL) {
+        atomic_fetch_add_i32(&job->counter->value, -1);
+    }
+}
+
+// NOTE: Pairs with the re-check in job_worker_main: either the pusher sees the sleeper or the
+// sleeper sees the pushed jobs, the wait timeout only covers semaphore posts that were used up by
+// workers that woke for other reasons.
+static void job_wake(JobSystem *system, unsigned int jobs_count) {
+    atomic_fence();
+    int32_t sleeping = atomic_load_i32(&system->sleeping);
+    for(int32_t i = 0; i < sleeping && i < (int32_t)jobs_count; ++i) {
+        SDL_SemPost(system->wake);
+    }
+}
+
+static int job_worker_main(void *data) {
+    JobWorker *worker  = (JobWorker *)data;
+    JobSystem *system  = worker->system;
+    job_current_worker = worker;
+
+    unsigned int idle = 0;
+    while(!atomic_load_i32(&system->quit)) {
+        Job job;
+        if(job_find(system, worker, &job)) {
+            job_execute(worker, &job);
+            idle = 0;
+            continue;
+        }
+        if(++idle < JOB_SPIN_COUNT) {
+            cpu_pause();
+            continue;
+        }
+
+        atomic_fetch_add_i32(&system->sleeping, 1);
+        bool found = job_find(system, worker, &job);
+        if(!found && !atomic_load_i32(&system->quit)) {
+            SDL_SemWaitTimeout(system->wake, JOB_SLEEP_TIMEOUT_MS);
+            ++worker->sleep_count;
+        }
+        atomic_fetch_add_i32(&system->sleeping, -1);
+        if(found) {
+            job_execute(worker, &job);
+        }
+        idle = 0;
+    }
+    return 0;
+}
+
+// NOTE: workers_count includes the calling thread, 1 runs every job inline on it.
+void job_system_init(JobSystem *system, unsigned int workers_count) {
+    memset(system, 0, sizeof(*system));
+    system->workers_count = clamp(workers_count, 1, JOB_MAX_WORKERS);
+    system->wake          = SDL_CreateSemaphore(0);
+    if(system->wake == NULL) {
+        printf("Failed to create job system semaphore!\n");
+        exit(1);
+    }
+
+    for(unsigned int worker_index = 0; worker_index < system->workers_count; ++worker_index) {
+        JobWorker *worker = &system->workers[worker_index];
+        worker->system    = system;
+        worker->index     = worker_index;
+        worker->random    = 0x9e3779b9u * (worker_index + 1);
+    }
+    job_current_worker = &system->workers[0];
+    for(unsigned int worker_index = 1; worker_index < system->workers_count; ++worker_index) {
+        JobWorker *worker = &system->workers[worker_index];
+        worker->thread    = SDL_CreateThread(job_worker_main, "job worker", worker);
+        if(worker->thread == NULL) {
+            printf("Failed to create job worker thread!\n");
+            exit(1);
+        }
+    }
+}
+
+// NOTE: Index of the worker running the calling thread, in [0, workers_count).
+unsigned int job_worker_index(void) {
+    assert(job_current_worker != NULL);
+    return job_current_worker->index;
+}
+
+static inline Job job_make(JobFunc *func, void *data, unsigned int first, unsigned int count,
+                           JobCounter *counter) {
+    Job job     = { 0 };
+    job.func    = func;
+    job.data    = data;
+    job.first   = first;
+    job.count   = count;
+    job.counter = counter;
+    return job;
+}
+
+// NOTE: counter can be NULL for jobs nobody waits on.
+void job_submit(JobSystem *system, JobFunc *func, void *data, unsigned int first,
+                unsigned int count, JobCounter *counter) {
+    JobWorker *worker = job_current_worker;
+    assert(worker != NULL && worker->system == system);
+    if(counter != NULL) {
+        atomic_fetch_add_i32(&counter->value, 1);
+    }
+    job_deque_push(&worker->deque, job_make(func, data, first, count, counter));
+    job_wake(system, 1);
+}
+
+bool job_counter_done(JobCounter *counter) {
+    return atomic_load_i32(&counter->value) == 0;
+}
+
+// NOTE: Runs jobs, the worker's own first, until every job on the counter finished.
+void job_wait(JobSystem *system, JobCounter *counter) {
+    JobWorker *worker = job_current_worker;
+    assert(worker != NULL && worker->system == system);
+    while(!job_counter_done(counter)) {
+        Job job;
+        if(job_find(system, worker, &job)) {
+            job_execute(worker, &job);
+        } else {
+            cpu_pause();
+        }
+    }
+}
+
+// NOTE: Splits [0, count) in batches of at least min_batch items, runs them on every worker and
+// returns once all of them finished. The batches differ by at most one item.
+void job_parallel_for(JobSystem *system, unsigned int count, unsigned int min_batch,
+                      JobFunc *func, void *data) {
+    if(count == 0) {
+        return;
+    }
+    unsigned int batches_count = (count + max(min_batch, 1) - 1) / max(min_batch, 1);
+    batches_count = min(batches_count, system->workers_count * JOB_BATCHES_PER_WORKER);
+    if(batches_count == 1) {
+        func(data, 0, count);
+        return;
+    }
+
+    JobWorker *worker = job_current_worker;
+    assert(worker != NULL && worker->system == system);
+    JobCounter counter = { 0 };
+    atomic_fetch_add_i32(&counter.value, (int32_t)batches_count);
+    unsigned int base  = count / batches_count;
+    unsigned int extra = count % batches_count;
+    unsigned int first = 0;
+    for(unsigned int batch = 0; batch < batches_count; ++batch) {
+        unsigned int batch_count = base + (batch < extra ? 1 : 0);
+        job_deque_push(&worker->deque, job_make(func, data, first, batch_count, &counter));
+        first += batch_count;
+    }
+    job_wake(system, batches_count);
+    job_wait(system, &counter);
+}
+
+void job_system_print_stats(JobSystem *system) {
+    printf("jobs: %u workers\n", system->workers_count);
+    for(unsigned int worker_index = 0; worker_index < system->workers_count; ++worker_index) {
+        JobWorker *worker = &system->workers[worker_index];
+        printf("  worker %2u: %llu executed, %llu stolen, %llu sleeps\n", worker_index,
+               (unsigned long long)worker->executed_count,
+               (unsigned long long)worker->stolen_count,
+               (unsigned long long)worker->sleep_count);
+    }
+}
+
+// NOTE: Every counter must be done, jobs still queued are dropped.
+void job_system_shutdown(JobSystem *system) {
+    atomic_store_i32(&system->quit, 1);
+    for(unsigned int worker_index = 1; worker_index < system->workers_count; ++worker_index) {
+        SDL_SemPost(system->wake);
+    }
+    for(unsigned int worker_index = 1; worker_index < system->workers_count; ++worker_index) {
+        SDL_WaitThread(system->workers[worker_index].thread, NULL);
+    }
+    SDL_DestroySemaphore(system->wake);
+    job_current_worker = NULL;
+}
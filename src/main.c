@@ -1,23 +1,17 @@
-#include <stdio.h>
-#include <stdbool.h>
-#include <stdlib.h>
-#include <assert.h>
-#include <string.h>
+#include "common.h"
+
+#include <math.h>
 
 #define SDL_MAIN_HANDLED
 #include <SDL.h>
 #include <SDL_vulkan.h>
 #include <vulkan/vulkan.h>
 
-#define array_len(v) (sizeof((v)) / sizeof((v)[0]))
-#define is_power_of_two(expr) (((expr) & (expr - 1)) == 0)
-#define unused(v) ((void)(v))
-
-#define kb(x) ((x) * 1024ll)
-#define mb(x) (kb(x) * 1024ll)
-#define gb(x) (mb(x) * 1024ll)
-
-#define clamp(a, b, c) max(min(a, c), b)
+#include "arena.c"
+#include "file.c"
+#include "pack.c"
+#include "job.c"
+#include "frame_pacer.c"
 
 typedef union V2 {
     struct {
@@ -52,58 +46,93 @@ typedef struct Vertex {
 #define VERTEX_LOC_POS 0
 #define VERTEX_LOC_COL 1
 
-typedef struct Arena {
-    void *data;
-    size_t used;
-    size_t size;
-} Arena;
+// NOTE: Per instance attributes, read from binding 1 once per instance. depth is the clip space z
+// of the instance, 0 being the nearest.
+typedef struct Instance {
+    V2 offset;
+    float scale;
+    V3 color;
+    float depth;
+} Instance;
+
+#define INSTANCE_LOC_OFFSET 2
+#define INSTANCE_LOC_SCALE 3
+#define INSTANCE_LOC_COL 4
+#define INSTANCE_LOC_DEPTH 5
+#define VERTEX_ATTRIBUTES_COUNT 6
+
+#include "gpu_memory.c"
+
+// NOTE: Frames in flight are picked at runtime, this only caps them for the few fixed size
+// arrays of the subsystems. The arrays of VkState are allocated to the actual count.
+#define MAX_FRAMES_IN_FLIGHT 4
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define PERSISTENT_ARENA_SIZE gb(4)
+#define SWAPCHAIN_ARENA_SIZE mb(64)
+// NOTE: Arenas of destroyed swapchains kept for the next ones, more are released.
+#define SWAPCHAIN_SPARE_ARENAS 4
+#define FRAME_ARENA_SIZE gb(1)
+#define ASSET_LOADER_WORKERS 2
+#define SCENE_INSTANCES_COUNT 100000
+#define BENCH_RECORD_DRAWS 50000
+#define BENCH_RECORD_ITERATIONS 50
+#define SCENE_EXTENT 2.0f
+// NOTE: Instances of the grid are this many cells wide, so they overlap and the scene has
+// overdraw for the depth test to reject.
+#define SCENE_OVERDRAW 2.0f
+// NOTE: Timestamps of a frame, at its start, after its uploads and at its end.
+#define FRAME_TIMESTAMPS 3
+#define CULL_GROUP_SIZE 64
+#define CULL_JOB_SIZE 4096
+#define SCENE_PIPELINES_COUNT 2
+#define SCENE_MESHES_COUNT 2
+#define ASSET_PACK_PATH "./res.pack"
+#define PIPELINE_CACHE_PATH "./pipeline_cache.bin"
+
+#include "deletion_queue.c"
+#include "upload.c"
+#include "cull.c"
+#include "bvh.c"
+#include "asset_loader.c"
+#include "pipeline_cache.c"
+#include "render_graph.c"
+#include "command_recorder.c"
+#include "draw_queue.c"
+// NOTE: Vertices and indices share one DEVICE_LOCAL buffer, the indices start at index_offset.
+// 16 bit indices are used whenever every vertex can be addressed with them.
+typedef struct Mesh {
+    VkBuffer buffer;
+    GpuAllocation memory;
+    VkDeviceSize index_offset;
+    VkIndexType index_type;
+    unsigned int vertices_count;
+    unsigned int indices_count;
+    float bounds_radius;
+} Mesh;
+
+// NOTE: What an instance is drawn with when it gets its own draw. Pipeline 0 is opaque and 1
+// blends additively, mesh 0 is the triangle and 1 the quad. The instanced and GPU driven paths
+// draw everything with pipeline 0 and mesh 0.
+typedef struct SceneMaterial {
+    uint8_t pipeline;
+    uint8_t mesh;
+} SceneMaterial;
+
+// NOTE: The view in clip space, the depths of the scene are all in [0, 1] so the near and far
+// planes never cull.
+const CullPlane view_planes[CULL_PLANES_COUNT] = {
+    { 1.0f, 0.0f, 0.0f, 1.0f },  { -1.0f, 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f },
+    { 0.0f, -1.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f, 1.0f },  { 0.0f, 0.0f, -1.0f, 1.0f },
+};
+
+// NOTE: Matches the push constants in cull.comp. The planes are (normal.xy, 0, distance) in clip
+// space, an object is culled when its bounding circle is fully behind any of them.
+typedef struct CullParams {
+    float planes[4][4];
+    uint32_t objects_count;
+    float bounds_radius;
+} CullParams;
 
-Arena arena_create(size_t size) {
-    Arena arena;
-    arena.data = malloc(size);
-    arena.used = 0;
-    arena.size = size;
-    return arena;
-}
-
-void *arena_push(Arena *arena, size_t size, size_t align) {
-    assert(is_power_of_two(align));
-    uintptr_t unaligned_addr = (uintptr_t)arena->data + arena->used;
-    uintptr_t aligned_addr   = (unaligned_addr + (align - 1)) & ~(align - 1);
-    assert(aligned_addr % align == 0);
-    size_t current_used = (aligned_addr - (uintptr_t)arena->data);
-    size_t total_used   = current_used + size;
-    assert(total_used <= arena->size);
-    arena->used  = total_used;
-    void *result = (void *)aligned_addr;
-    memset(result, 0, size);
-    return result;
-}
-
-void arena_clear(Arena *arena) {
-    arena->used = 0;
-}
-
-typedef struct File {
-    void *data;
-    size_t size;
-} File;
-
-File read_entire_file(Arena *arena, const char *path) {
-    File result = { 0 };
-    FILE *file  = fopen(path, "rb");
-    fseek(file, 0, SEEK_END);
-    unsigned int size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    result.data = arena_push(arena, size + 1, 1);
-    result.size = size;
-    fread(result.data, result.size, 1, file);
-    ((unsigned char *)result.data)[result.size] = '\0';
-    fclose(file);
-    return result;
-}
-
-#define MAX_FRAMES_IN_FLIGHT 2
 const char *validation_layers[] = { "VK_LAYER_KHRONOS_validation" };
 const char *device_extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
@@ -113,6 +142,17 @@ const Vertex vertices[] = {
     {{ -0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f }}
 };
 
+const uint32_t indices[] = { 0, 1, 2 };
+
+const Vertex quad_vertices[] = {
+    {{ -0.5f, -0.5f }, { 1.0f, 1.0f, 0.0f }},
+    { { 0.5f, -0.5f }, { 0.0f, 1.0f, 1.0f }},
+    {  { 0.5f, 0.5f }, { 1.0f, 0.0f, 1.0f }},
+    { { -0.5f, 0.5f }, { 1.0f, 1.0f, 1.0f }}
+};
+
+const uint32_t quad_indices[] = { 0, 1, 2, 2, 3, 0 };
+
 static inline VkVertexInputBindingDescription vertex_get_binding_description(void) {
     VkVertexInputBindingDescription bindingDescription = { 0 };
     bindingDescription.binding                         = 0;
@@ -121,6 +161,14 @@ static inline VkVertexInputBindingDescription vertex_get_binding_description(voi
     return bindingDescription;
 }
 
+static inline VkVertexInputBindingDescription instance_get_binding_description(void) {
+    VkVertexInputBindingDescription bindingDescription = { 0 };
+    bindingDescription.binding                         = 1;
+    bindingDescription.stride                          = sizeof(Instance);
+    bindingDescription.inputRate                       = VK_VERTEX_INPUT_RATE_INSTANCE;
+    return bindingDescription;
+}
+
 static inline void vertex_get_attribute_desc(VkVertexInputAttributeDescription *attr_desc) {
     attr_desc[VERTEX_LOC_POS].binding  = 0;
     attr_desc[VERTEX_LOC_POS].location = 0;
@@ -131,6 +179,135 @@ static inline void vertex_get_attribute_desc(VkVertexInputAttributeDescription *
     attr_desc[VERTEX_LOC_COL].location = 1;
     attr_desc[VERTEX_LOC_COL].format   = VK_FORMAT_R32G32B32_SFLOAT;
     attr_desc[VERTEX_LOC_COL].offset   = offsetof(Vertex, color);
+
+    attr_desc[INSTANCE_LOC_OFFSET].binding  = 1;
+    attr_desc[INSTANCE_LOC_OFFSET].location = INSTANCE_LOC_OFFSET;
+    attr_desc[INSTANCE_LOC_OFFSET].format   = VK_FORMAT_R32G32_SFLOAT;
+    attr_desc[INSTANCE_LOC_OFFSET].offset   = offsetof(Instance, offset);
+
+    attr_desc[INSTANCE_LOC_SCALE].binding  = 1;
+    attr_desc[INSTANCE_LOC_SCALE].location = INSTANCE_LOC_SCALE;
+    attr_desc[INSTANCE_LOC_SCALE].format   = VK_FORMAT_R32_SFLOAT;
+    attr_desc[INSTANCE_LOC_SCALE].offset   = offsetof(Instance, scale);
+
+    attr_desc[INSTANCE_LOC_COL].binding  = 1;
+    attr_desc[INSTANCE_LOC_COL].location = INSTANCE_LOC_COL;
+    attr_desc[INSTANCE_LOC_COL].format   = VK_FORMAT_R32G32B32_SFLOAT;
+    attr_desc[INSTANCE_LOC_COL].offset   = offsetof(Instance, color);
+
+    attr_desc[INSTANCE_LOC_DEPTH].binding  = 1;
+    attr_desc[INSTANCE_LOC_DEPTH].location = INSTANCE_LOC_DEPTH;
+    attr_desc[INSTANCE_LOC_DEPTH].format   = VK_FORMAT_R32_SFLOAT;
+    attr_desc[INSTANCE_LOC_DEPTH].offset   = offsetof(Instance, depth);
+}
+
+typedef struct Config {
+    unsigned int instances_count;
+    // NOTE: Record one draw per instance instead of a single instanced draw, for comparison.
+    bool no_instancing;
+    // NOTE: Cull and build the draw on the GPU, see vulkan_record_cull.
+    bool gpu_culling;
+    // NOTE: Cull on the CPU by walking a BVH of the instances instead of testing all of them.
+    bool use_bvh;
+    // NOTE: Draw the scene into an offscreen target that a post pass copies to the swapchain.
+    bool post;
+    // NOTE: Job system workers including the main thread, they cull and record the per instance
+    // draws of --no-instancing. 1 runs everything on the main thread.
+    unsigned int job_threads;
+    // NOTE: Measure record time against thread count at BENCH_RECORD_DRAWS draws and exit.
+    bool bench_record;
+    // NOTE: Issue the per instance draws in submission order instead of sorting them by state.
+    bool no_draw_sort;
+    // NOTE: Lay down the depth of the scene with a position only pass first, so the scene pass
+    // only shades the visible fragment of every pixel.
+    bool depth_prepass;
+    // NOTE: 1 to MAX_FRAMES_IN_FLIGHT. wait_early waits for the previous frame before polling
+    // input instead of right before recording, see --latency-mode.
+    unsigned int frames_in_flight;
+    bool wait_early;
+    const char *latency_mode;
+    // NOTE: Frame rate limit, 0 runs as fast as presenting allows.
+    unsigned int target_fps;
+    // NOTE: Synchronize frames with fences even when timeline semaphores are supported.
+    bool no_timeline;
+    // NOTE: Record uploads on the graphics queue even when there is a transfer only queue.
+    bool no_transfer_queue;
+    // NOTE: Upload the scene every frame to measure what uploads cost a frame. The GPU culling pass
+    // is what reads it, so this turns GPU culling on.
+    bool upload_stress;
+} Config;
+
+Config config_parse(int argc, char **argv) {
+    Config config           = { 0 };
+    config.instances_count  = 1;
+    config.job_threads      = (unsigned int)SDL_GetCPUCount();
+    config.frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT;
+    config.latency_mode     = "default";
+    for(int arg_index = 1; arg_index < argc; ++arg_index) {
+        const char *arg = argv[arg_index];
+        if(strcmp(arg, "--scene") == 0 && arg_index + 1 < argc &&
+           strcmp(argv[arg_index + 1], "instances") == 0) {
+            config.instances_count = SCENE_INSTANCES_COUNT;
+            ++arg_index;
+        } else if(strcmp(arg, "--no-instancing") == 0) {
+            config.no_instancing = true;
+        } else if(strcmp(arg, "--gpu-culling") == 0) {
+            config.gpu_culling = true;
+        } else if(strcmp(arg, "--bvh") == 0) {
+            config.use_bvh = true;
+        } else if(strcmp(arg, "--post") == 0) {
+            config.post = true;
+        } else if(strcmp(arg, "--job-threads") == 0 && arg_index + 1 < argc) {
+            config.job_threads = (unsigned int)atoi(argv[++arg_index]);
+        } else if(strcmp(arg, "--no-draw-sort") == 0) {
+            config.no_draw_sort = true;
+        } else if(strcmp(arg, "--depth-prepass") == 0) {
+            config.depth_prepass = true;
+        } else if(strcmp(arg, "--target-fps") == 0 && arg_index + 1 < argc) {
+            config.target_fps = (unsigned int)atoi(argv[++arg_index]);
+        } else if(strcmp(arg, "--no-timeline") == 0) {
+            config.no_timeline = true;
+        } else if(strcmp(arg, "--no-transfer-queue") == 0) {
+            config.no_transfer_queue = true;
+        } else if(strcmp(arg, "--upload-stress") == 0) {
+            config.upload_stress = true;
+            config.gpu_culling   = true;
+        } else if(strcmp(arg, "--frames-in-flight") == 0 && arg_index + 1 < argc) {
+            config.frames_in_flight = (unsigned int)atoi(argv[++arg_index]);
+            config.latency_mode     = "custom";
+            if(config.frames_in_flight < 1 || config.frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+                printf("--frames-in-flight must be between 1 and %d\n", MAX_FRAMES_IN_FLIGHT);
+                exit(1);
+            }
+        } else if(strcmp(arg, "--latency-mode") == 0 && arg_index + 1 < argc &&
+                  strcmp(argv[arg_index + 1], "low-latency") == 0) {
+            // NOTE: One frame in flight, and the CPU waits for it before sampling input, so the
+            // input a frame sees is as fresh as possible at the cost of CPU/GPU overlap.
+            config.frames_in_flight = 1;
+            config.wait_early       = true;
+            config.latency_mode     = argv[++arg_index];
+        } else if(strcmp(arg, "--latency-mode") == 0 && arg_index + 1 < argc &&
+                  strcmp(argv[arg_index + 1], "throughput") == 0) {
+            // NOTE: Three frames in flight keep the GPU fed through CPU hitches, input is up to
+            // three frames old by the time it is shown.
+            config.frames_in_flight = 3;
+            config.wait_early       = false;
+            config.latency_mode     = argv[++arg_index];
+        } else if(strcmp(arg, "--bench-record") == 0) {
+            config.bench_record    = true;
+            config.instances_count = SCENE_INSTANCES_COUNT;
+            config.no_instancing   = true;
+        } else {
+            printf("usage: %s [--scene instances] [--no-instancing] [--gpu-culling] [--bvh] "
+                   "[--post] [--job-threads n] [--bench-record] [--no-draw-sort] "
+                   "[--depth-prepass] [--frames-in-flight n] "
+                   "[--latency-mode low-latency|throughput] [--target-fps n] [--no-timeline] "
+                   "[--no-transfer-queue] [--upload-stress]\n",
+                   argv[0]);
+            exit(1);
+        }
+    }
+    return config;
 }
 
 typedef struct VkState {
@@ -139,44 +316,199 @@ typedef struct VkState {
     VkSurfaceKHR surface;
     VkPhysicalDevice physical_device;
     unsigned int present_queue_index, graphics_queue_index, queue_family_count;
+    unsigned int transfer_queue_index;
+    unsigned int graphics_timestamp_bits;
     VkDevice device;
+    // NOTE: The optional features that were enabled on the device.
+    VkPhysicalDeviceFeatures device_features;
 
     VkFormat swapchain_image_format;
     VkExtent2D swapchain_extent;
+    VkImageUsageFlags swapchain_usage;
     VkSwapchainKHR swapchain;
 
+    // NOTE: Everything that lives as long as the swapchain is pushed here and released with it on
+    // recreation, the arenas of destroyed swapchains are kept as spares for the next ones. Per
+    // frame scratch goes in the frame arena, reset when the frame's fence signals.
+    Arena swapchain_arena;
+    Arena *frame_arenas;
+    Arena spare_swapchain_arenas[SWAPCHAIN_SPARE_ARENAS];
+    unsigned int spare_swapchain_arenas_count;
+    unsigned int swapchains_recreated;
+
     unsigned int swapchain_images_count;
+    VkImage *swapchain_images;
     VkImageView *swapchain_images_views;
 
+    // NOTE: Rebuilt with the swapchain. render_pass is the one of the scene pass, the graphics
+    // pipelines are created against it and depth_pipeline against depth_render_pass. The depth
+    // buffer is a transient of the graph, so it is recreated with the swapchain too. The graph is
+    // pushed on the swapchain arena.
+    RenderGraph *render_graph;
+    unsigned int scene_pass;
+    unsigned int depth_pass;
+    unsigned int swapchain_resource;
+    unsigned int scene_color;
+    unsigned int scene_depth;
+    VkFormat depth_format;
+    bool post;
+    bool depth_prepass;
     VkRenderPass render_pass;
-    VkPipeline pipeline;
+    VkRenderPass depth_render_pass;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipelines[SCENE_PIPELINES_COUNT];
+    VkPipeline depth_pipeline;
 
-    VkFramebuffer *framebuffers;
-    unsigned int framebuffers_count;
+    // NOTE: Fragment shader invocations of every frame, counted by a pipeline statistics query
+    // per frame slot and read back once the slot's fence signaled.
+    VkQueryPool statistics_pool;
+    bool *statistics_pending;
+    unsigned long long fragment_invocations_total;
+    unsigned long long frames_queried;
 
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
-
-    VkSemaphore image_available_semaphores[MAX_FRAMES_IN_FLIGHT];
-    VkSemaphore render_finished_semaphores[MAX_FRAMES_IN_FLIGHT];
-    VkFence in_flight_fences[MAX_FRAMES_IN_FLIGHT];
-
+    VkCommandBuffer *command_buffers;
+
+    JobSystem *jobs;
+
+    // NOTE: With --no-instancing and more than one job worker the scene pass is recorded in
+    // parallel into secondary command buffers.
+    CommandRecorder recorder;
+    bool parallel_record;
+    unsigned int record_slices;
+
+    VkSemaphore *image_available_semaphores;
+    VkSemaphore *render_finished_semaphores;
+    VkFence *in_flight_fences;
+
+    // NOTE: The Vulkan version of the instance, 1.2 when the loader has it. With timeline
+    // semaphores every graphics submit signals frame_timeline with its frame number and the CPU
+    // waits on values of it, the fences are only created without them. Presenting still needs
+    // the binary semaphores.
+    uint32_t api_version;
+    bool timeline;
+    VkSemaphore frame_timeline;
+    // NOTE: Vulkan 1.2 entry points, loaded at device creation and only set with timeline.
+    PFN_vkWaitSemaphores wait_semaphores;
+    PFN_vkGetSemaphoreCounterValue get_semaphore_counter_value;
+
+    // NOTE: Uploads go through a transfer only queue family when the device has one and timeline
+    // semaphores are on, see vulkan_submit_uploads. The frame that consumes them waits for
+    // transfer_timeline to reach the value of their submit.
+    bool use_transfer_queue;
+    VkQueue transfer_queue;
+    VkCommandPool transfer_command_pool;
+    VkCommandBuffer *transfer_command_buffers;
+    VkSemaphore transfer_timeline;
+    uint64_t transfer_value;
+
+    // NOTE: FRAME_TIMESTAMPS per frame slot on the graphics queue, read back with the statistics.
+    // The uploads' time is the part of the frame spent on copies, it is only measured when they
+    // are recorded on the graphics queue.
+    VkQueryPool timestamp_pool;
+    float timestamp_period;
+    bool *timestamps_pending;
+    double gpu_frame_ms_total;
+    double gpu_upload_ms_total;
+    unsigned long long frames_timed;
+
+    // NOTE: Every per frame array has frames_in_flight entries, see vulkan_create_frames.
+    // frame_waited is set once the fence of current_frame was waited on, which with wait_early
+    // happens before the input of the frame is polled.
+    unsigned int frames_in_flight;
+    bool wait_early;
+    bool frame_waited;
+    const char *latency_mode;
     unsigned int current_frame;
     bool framebuffer_resized;
 
-    VkBuffer vertex_buffer;
-    VkDeviceMemory vertex_buffer_memory;
+    // NOTE: Every submitted frame gets the next frame_number, frame_numbers has the one last
+    // submitted to each slot. Frames finish in submission order on the graphics queue, so once a
+    // slot's fence signaled every frame up to its number is done, that is completed_frame.
+    uint64_t frame_number;
+    uint64_t completed_frame;
+    uint64_t *frame_numbers;
+
+    // NOTE: Objects released with vulkan_release, destroyed once completed_frame reaches them.
+    DeletionQueue deletion_queue;
+
+    // NOTE: Input to present latency. The input time of a frame is when its events were polled
+    // and it counts as presented once its fence signals, the display's own latency comes on top.
+    // The fence is only checked when its slot comes around again, so a CPU bound frame whose
+    // fence signaled long before reads high.
+    Uint64 input_time;
+    Uint64 *frame_input_times;
+    double latency_ms_total;
+    double latency_ms_max;
+    unsigned long long latency_samples;
+    double fence_wait_ms_total;
+    Uint64 first_present_time;
+    Uint64 last_present_time;
+    unsigned long long presents_count;
+
+    GpuAllocator gpu_allocator;
+    UploadRing upload_ring;
+    PipelineCache pipeline_cache;
+
+    Mesh meshes[SCENE_MESHES_COUNT];
+
+    // NOTE: The instances that pass CPU culling are copied every frame into the instance buffer
+    // of the frame slot.
+    Instance *instances;
+    SceneMaterial *materials;
+    unsigned int instances_count;
+    CullBounds cull_bounds;
+    CullPath cull_path;
+    unsigned int visible_count;
+    bool use_bvh;
+    Bvh bvh;
+    bool no_instancing;
+    VkBuffer *instance_buffers;
+    GpuAllocation *instance_buffers_memory;
+
+    // NOTE: With --no-instancing every visible instance is a draw packet, sorted by state unless
+    // --no-draw-sort is given. The bind counts are summed over the frames for the averages.
+    DrawQueue draw_queue;
+    bool sort_draws;
+    unsigned long long binds_unsorted_total;
+    unsigned long long binds_total;
+    double sort_ms_total;
+    unsigned int sort_passes;
+
+    // NOTE: GPU driven path. The scene is uploaded once, every frame a compute pass culls it into
+    // the visible buffer of the frame slot and writes the instance count of the indirect draw.
+    // With stream_scene it is uploaded again every frame instead, into a scene buffer per frame
+    // slot so the upload doesn't have to wait for the frames still reading the previous one.
+    bool gpu_culling;
+    bool stream_scene;
+    unsigned int scene_buffers_count;
+    VkBuffer *scene_buffers;
+    GpuAllocation *scene_buffers_memory;
+    VkBuffer *visible_buffers;
+    GpuAllocation *visible_buffers_memory;
+    VkBuffer *indirect_buffers;
+    GpuAllocation *indirect_buffers_memory;
+    VkDescriptorSetLayout cull_set_layout;
+    VkDescriptorPool cull_descriptor_pool;
+    VkDescriptorSet *cull_sets;
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipeline cull_pipeline;
+
+    double record_ms_total;
+    unsigned long long frames_recorded;
+    unsigned int draws_count;
 
 } VkState;
 
 void check_device_extensions(VkPhysicalDevice device, Arena *arena, const char **extensions,
                              unsigned extensions_count, bool *extensions_found) {
     *extensions_found = true;
+    TempMemory temp   = temp_memory_begin(arena);
 
     unsigned int device_extension_count = 0;
     vkEnumerateDeviceExtensionProperties(device, NULL, &device_extension_count, NULL);
-    VkExtensionProperties *device_extension_props = (VkExtensionProperties *)arena_push(
-        arena, sizeof(VkExtensionProperties) * device_extension_count, 1);
+    VkExtensionProperties *device_extension_props =
+        arena_push_array_no_zero(arena, VkExtensionProperties, device_extension_count);
     vkEnumerateDeviceExtensionProperties(device, NULL, &device_extension_count,
                                          device_extension_props);
 
@@ -197,16 +529,19 @@ void check_device_extensions(VkPhysicalDevice device, Arena *arena, const char *
             break;
         }
     }
+
+    temp_memory_end(temp);
 }
 
 void check_validation_layers(Arena *arena, const char **validation_layers,
                              unsigned int validtion_layers_count, bool *validation_layers_found) {
     *validation_layers_found = true;
+    TempMemory temp          = temp_memory_begin(arena);
 
     unsigned int layers_count = 0;
     vkEnumerateInstanceLayerProperties(&layers_count, NULL);
     VkLayerProperties *layers_props =
-        (VkLayerProperties *)arena_push(arena, sizeof(VkLayerProperties) * layers_count, 1);
+        arena_push_array_no_zero(arena, VkLayerProperties, layers_count);
     vkEnumerateInstanceLayerProperties(&layers_count, layers_props);
     for(unsigned int validation_layer_index = 0; validation_layer_index < validtion_layers_count;
         ++validation_layer_index) {
@@ -226,9 +561,21 @@ void check_validation_layers(Arena *arena, const char **validation_layers,
             break;
         }
     }
+
+    temp_memory_end(temp);
 }
 
 void vulkan_create_instance(VkState *state, Arena *arena, SDL_Window *window) {
+    // NOTE: Vulkan 1.2 is asked for when the loader has it, for timeline semaphores.
+    // vkEnumerateInstanceVersion only exists from 1.1 on, a 1.0 loader doesn't return it.
+    uint32_t api_version = VK_API_VERSION_1_0;
+    PFN_vkEnumerateInstanceVersion enumerate_instance_version =
+        (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+    if(enumerate_instance_version != NULL) {
+        enumerate_instance_version(&api_version);
+    }
+    state->api_version = min(api_version, VK_API_VERSION_1_2);
+
     // Create vulkan instance
     VkApplicationInfo app_info  = { 0 };
     app_info.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -237,13 +584,13 @@ void vulkan_create_instance(VkState *state, Arena *arena, SDL_Window *window) {
     app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     app_info.pEngineName        = NULL;
     app_info.engineVersion      = VK_MAKE_VERSION(1, 0, 0);
-    app_info.apiVersion         = VK_API_VERSION_1_0;
+    app_info.apiVersion         = state->api_version;
 
     // NOTE: Get SDL2 extensions
     unsigned int instance_extensions_count = 0;
     SDL_Vulkan_GetInstanceExtensions(window, &instance_extensions_count, NULL);
     const char **instance_extensions_names =
-        (const char **)arena_push(arena, instance_extensions_count * sizeof(const char **), 1);
+        arena_push_array_no_zero(arena, const char *, instance_extensions_count);
     SDL_Vulkan_GetInstanceExtensions(window, &instance_extensions_count, instance_extensions_names);
 
     // NOTE: Setup Validation layers
@@ -282,7 +629,7 @@ void vulkan_select_physical_device(VkState *state, Arena *arena) {
         exit(1);
     }
     VkPhysicalDevice *physical_devices =
-        (VkPhysicalDevice *)arena_push(arena, sizeof(VkPhysicalDevice) * device_count, 1);
+        arena_push_array_no_zero(arena, VkPhysicalDevice, device_count);
     vkEnumeratePhysicalDevices(state->instance, &device_count, physical_devices);
 
     // NOTE: Find suitable device
@@ -306,13 +653,28 @@ void vulkan_select_physical_device(VkState *state, Arena *arena) {
     assert(state->physical_device != VK_NULL_HANDLE);
 }
 
+// NOTE: The first depth format that can be a depth attachment, D16_UNORM is always supported.
+void vulkan_select_depth_format(VkState *state) {
+    VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32,
+                              VK_FORMAT_D16_UNORM };
+    state->depth_format   = VK_FORMAT_D16_UNORM;
+    for(unsigned int i = 0; i < array_len(candidates); ++i) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(state->physical_device, candidates[i], &props);
+        if(props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            state->depth_format = candidates[i];
+            break;
+        }
+    }
+}
+
 void vulkan_find_family_queues(VkState *state, Arena *arena) {
     // NOTE: Find queue family queues
     state->queue_family_count = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(state->physical_device, &state->queue_family_count,
                                              NULL);
     VkQueueFamilyProperties *queue_family_props =
-        arena_push(arena, sizeof(VkQueueFamilyProperties) * state->queue_family_count, 1);
+        arena_push_array_no_zero(arena, VkQueueFamilyProperties, state->queue_family_count);
     vkGetPhysicalDeviceQueueFamilyProperties(state->physical_device, &state->queue_family_count,
                                              queue_family_props);
     state->graphics_queue_index = (unsigned int)-1;
@@ -342,17 +704,35 @@ void vulkan_find_family_queues(VkState *state, Arena *arena) {
         printf("Present Queue not supported!\n");
         exit(1);
     }
+    state->graphics_timestamp_bits =
+        queue_family_props[state->graphics_queue_index].timestampValidBits;
+
+    // NOTE: A family that can transfer but neither draw nor compute is a dedicated copy engine.
+    // state->use_transfer_queue comes in false when --no-transfer-queue asked for the graphics
+    // queue.
+    state->transfer_queue_index = (unsigned int)-1;
+    for(unsigned int i = 0; i < state->queue_family_count; ++i) {
+        VkQueueFlags flags = queue_family_props[i].queueFlags;
+        if((flags & VK_QUEUE_TRANSFER_BIT) &&
+           !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            state->transfer_queue_index = i;
+            break;
+        }
+    }
+    state->use_transfer_queue =
+        state->use_transfer_queue && state->transfer_queue_index != (unsigned int)-1;
 }
 
 void vulkan_create_logical_device(VkState *state, Arena *arena) {
     float queue_priority = 1.0f;
 
-    unsigned int queue_families[] = { state->present_queue_index, state->graphics_queue_index };
-    VkDeviceQueueCreateInfo *queue_create_infos = (VkDeviceQueueCreateInfo *)arena_push(
-        arena, sizeof(VkDeviceQueueCreateInfo) * array_len(queue_families), 1);
+    unsigned int queue_families[] = { state->present_queue_index, state->graphics_queue_index,
+                                      state->use_transfer_queue ? state->transfer_queue_index
+                                                                : state->graphics_queue_index };
+    VkDeviceQueueCreateInfo *queue_create_infos =
+        arena_push_array(arena, VkDeviceQueueCreateInfo, array_len(queue_families));
     unsigned int unique_families_count = 0;
-    bool *unique_families_state = arena_push(arena, sizeof(bool) * state->queue_family_count, 1);
-    memset(unique_families_state, 0, sizeof(bool) * state->queue_family_count);
+    bool *unique_families_state = arena_push_array(arena, bool, state->queue_family_count);
 
     for(unsigned int queue_index = 0; queue_index < array_len(queue_families); ++queue_index) {
         if(unique_families_state[queue_families[queue_index]] == false) {
@@ -377,10 +757,40 @@ void vulkan_create_logical_device(VkState *state, Arena *arena) {
     check_validation_layers(arena, validation_layers, array_len(validation_layers),
                             &validation_layer_found);
 
+    // NOTE: Pipeline statistics are only used for reporting, enable them when they are there.
+    // inheritedQueries lets the query stay active while secondary command buffers execute.
+    VkPhysicalDeviceFeatures supported_feats = { 0 };
+    vkGetPhysicalDeviceFeatures(state->physical_device, &supported_feats);
+    VkPhysicalDeviceFeatures device_feats = { 0 };
+    device_feats.pipelineStatisticsQuery  = supported_feats.pipelineStatisticsQuery;
+    device_feats.inheritedQueries         = supported_feats.inheritedQueries;
+    state->device_features                = device_feats;
+
+    // NOTE: Timeline semaphores need Vulkan 1.2 on both the instance and the device, the feature
+    // is queried through vkGetPhysicalDeviceFeatures2. state->timeline comes in false when
+    // --no-timeline asked for fences. The 1.1 and 1.2 entry points are loaded by name, a loader
+    // without them would otherwise fail to start instead of falling back to fences.
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(state->physical_device, &device_props);
+    state->timestamp_period = device_props.limits.timestampPeriod;
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_feats = { 0 };
+    timeline_feats.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    PFN_vkGetPhysicalDeviceFeatures2 get_physical_device_features2 =
+        (PFN_vkGetPhysicalDeviceFeatures2)vkGetInstanceProcAddr(state->instance,
+                                                                "vkGetPhysicalDeviceFeatures2");
+    if(state->timeline && state->api_version >= VK_API_VERSION_1_2 &&
+       device_props.apiVersion >= VK_API_VERSION_1_2 && get_physical_device_features2 != NULL) {
+        VkPhysicalDeviceFeatures2 supported_feats2 = { 0 };
+        supported_feats2.sType                     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supported_feats2.pNext                     = &timeline_feats;
+        get_physical_device_features2(state->physical_device, &supported_feats2);
+    }
+    state->timeline = timeline_feats.timelineSemaphore;
+
     // Create Logical Device
-    VkPhysicalDeviceFeatures device_feats   = { 0 };
     VkDeviceCreateInfo device_create_info   = { 0 };
     device_create_info.sType                = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_create_info.pNext                = state->timeline ? &timeline_feats : NULL;
     device_create_info.pQueueCreateInfos    = queue_create_infos;
     device_create_info.queueCreateInfoCount = unique_families_count;
     device_create_info.pEnabledFeatures     = &device_feats;
@@ -396,9 +806,24 @@ void vulkan_create_logical_device(VkState *state, Arena *arena) {
         printf("Failed to create logical device!\n");
         exit(1);
     }
+
+    if(state->timeline) {
+        state->wait_semaphores = (PFN_vkWaitSemaphores)vkGetDeviceProcAddr(state->device,
+                                                                           "vkWaitSemaphores");
+        state->get_semaphore_counter_value = (PFN_vkGetSemaphoreCounterValue)vkGetDeviceProcAddr(
+            state->device, "vkGetSemaphoreCounterValue");
+        state->timeline =
+            state->wait_semaphores != NULL && state->get_semaphore_counter_value != NULL;
+    }
+    // NOTE: The transfer submit waits on frame_timeline for the frames still reading what it
+    // overwrites, without it the uploads stay on the graphics queue.
+    state->use_transfer_queue = state->use_transfer_queue && state->timeline;
 }
 
-void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
+// NOTE: old_swapchain is the one being replaced or VK_NULL_HANDLE, passing it lets the driver
+// reuse its resources. It is retired by the call and can't acquire images anymore.
+void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window,
+                             VkSwapchainKHR old_swapchain) {
     // Query Swapchain support
     VkSurfaceCapabilitiesKHR capabilities = { 0 };
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(state->physical_device, state->surface,
@@ -408,7 +833,7 @@ void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
     vkGetPhysicalDeviceSurfaceFormatsKHR(state->physical_device, state->surface, &formats_count,
                                          NULL);
     VkSurfaceFormatKHR *formats =
-        (VkSurfaceFormatKHR *)arena_push(arena, sizeof(VkSurfaceFormatKHR) * formats_count, 1);
+        arena_push_array_no_zero(arena, VkSurfaceFormatKHR, formats_count);
     vkGetPhysicalDeviceSurfaceFormatsKHR(state->physical_device, state->surface, &formats_count,
                                          formats);
 
@@ -416,7 +841,7 @@ void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
     vkGetPhysicalDeviceSurfacePresentModesKHR(state->physical_device, state->surface,
                                               &present_modes_count, NULL);
     VkPresentModeKHR *present_modes =
-        (VkPresentModeKHR *)arena_push(arena, sizeof(VkPresentModeKHR) * present_modes_count, 1);
+        arena_push_array_no_zero(arena, VkPresentModeKHR, present_modes_count);
     vkGetPhysicalDeviceSurfacePresentModesKHR(state->physical_device, state->surface,
                                               &present_modes_count, present_modes);
 
@@ -477,6 +902,8 @@ void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
     swapchain_create_info.imageExtent              = extend;
     swapchain_create_info.imageArrayLayers         = 1;
     swapchain_create_info.imageUsage               = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    swapchain_create_info.imageUsage |=
+        capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
     if(state->graphics_queue_index != state->present_queue_index) {
         swapchain_create_info.imageSharingMode      = VK_SHARING_MODE_CONCURRENT;
@@ -492,7 +919,7 @@ void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
     swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapchain_create_info.presentMode    = present_mode;
     swapchain_create_info.clipped        = VK_TRUE;
-    swapchain_create_info.oldSwapchain   = VK_NULL_HANDLE;
+    swapchain_create_info.oldSwapchain   = old_swapchain;
 
     VkSwapchainKHR swapchain;
     if(vkCreateSwapchainKHR(state->device, &swapchain_create_info, NULL, &swapchain) !=
@@ -503,6 +930,7 @@ void vulkan_create_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
 
     state->swapchain_image_format = format.format;
     state->swapchain_extent       = extend;
+    state->swapchain_usage        = swapchain_create_info.imageUsage;
     state->swapchain              = swapchain;
 }
 
@@ -510,19 +938,19 @@ void vulkan_create_images_views(VkState *state, Arena *arena) {
     // NOTE: Retrive swapchain images
     state->swapchain_images_count = 0;
     vkGetSwapchainImagesKHR(state->device, state->swapchain, &state->swapchain_images_count, NULL);
-    VkImage *swapchain_images =
-        (VkImage *)arena_push(arena, sizeof(VkImage) * state->swapchain_images_count, 1);
+    state->swapchain_images =
+        arena_push_array_no_zero(arena, VkImage, state->swapchain_images_count);
     vkGetSwapchainImagesKHR(state->device, state->swapchain, &state->swapchain_images_count,
-                            swapchain_images);
+                            state->swapchain_images);
 
     state->swapchain_images_views =
-        (VkImageView *)arena_push(arena, sizeof(VkImageView) * state->swapchain_images_count, 1);
+        arena_push_array(arena, VkImageView, state->swapchain_images_count);
 
     // Create ImageView
     for(unsigned int image_index = 0; image_index < state->swapchain_images_count; ++image_index) {
         VkImageViewCreateInfo create_info           = { 0 };
         create_info.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        create_info.image                           = swapchain_images[image_index];
+        create_info.image                           = state->swapchain_images[image_index];
         create_info.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
         create_info.format                          = state->swapchain_image_format;
         create_info.components.r                    = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -543,6 +971,38 @@ void vulkan_create_images_views(VkState *state, Arena *arena) {
     }
 }
 
+// NOTE: Waits until every submitted frame completed. Without timeline semaphores it waits on
+// every fence, which are then either signaled or belong to a submitted frame.
+void vulkan_wait_all_frames(VkState *state) {
+    if(state->timeline) {
+        VkSemaphoreWaitInfo wait_info = { 0 };
+        wait_info.sType               = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount      = 1;
+        wait_info.pSemaphores         = &state->frame_timeline;
+        wait_info.pValues             = &state->frame_number;
+        state->wait_semaphores(state->device, &wait_info, UINT64_MAX);
+    } else {
+        vkWaitForFences(state->device, state->frames_in_flight, state->in_flight_fences, VK_TRUE,
+                        UINT64_MAX);
+    }
+    state->completed_frame = state->frame_number;
+}
+
+// NOTE: Destroys the object once every frame that may use it completed. It is tagged with the
+// frame being recorded, which is only submitted later. When the queue is full every frame in
+// flight is waited on, so this must not be called between a fence reset and its submit.
+void vulkan_release(VkState *state, Deletion deletion) {
+    deletion.frame = state->frame_number + 1;
+    if(!deletion_queue_push(&state->deletion_queue, deletion)) {
+        vulkan_wait_all_frames(state);
+        deletion_queue_collect(&state->deletion_queue, state->completed_frame);
+        if(!deletion_queue_push(&state->deletion_queue, deletion)) {
+            printf("Deletion queue full!\n");
+            exit(1);
+        }
+    }
+}
+
 VkShaderModule vulkan_create_shader_module(VkDevice device, File *file) {
     // Create shader module
     VkShaderModuleCreateInfo create_info = { 0 };
@@ -557,59 +1017,268 @@ VkShaderModule vulkan_create_shader_module(VkDevice device, File *file) {
     return shader_module;
 }
 
-void vulkan_create_render_pass(VkState *state) {
-    VkAttachmentDescription color_attachment = { 0 };
-    color_attachment.format                  = state->swapchain_image_format;
-    color_attachment.samples                 = VK_SAMPLE_COUNT_1_BIT;
-    color_attachment.loadOp                  = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    color_attachment.storeOp                 = VK_ATTACHMENT_STORE_OP_STORE;
-    color_attachment.stencilLoadOp           = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    color_attachment.stencilStoreOp          = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    color_attachment.initialLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout             = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    VkAttachmentReference color_attachment_ref = { 0 };
-    color_attachment_ref.attachment            = 0;
-    color_attachment_ref.layout                = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpass = { 0 };
-    subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments    = &color_attachment_ref;
-
-    VkSubpassDependency dependency = { 0 };
-    dependency.srcSubpass          = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass          = 0;
-    dependency.srcStageMask        = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask       = 0;
-    dependency.dstStageMask        = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask       = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    VkRenderPassCreateInfo render_pass_info = { 0 };
-    render_pass_info.sType                  = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount        = 1;
-    render_pass_info.pAttachments           = &color_attachment;
-    render_pass_info.subpassCount           = 1;
-    render_pass_info.pSubpasses             = &subpass;
-    render_pass_info.dependencyCount        = 1;
-    render_pass_info.pDependencies          = &dependency;
-
-    if(vkCreateRenderPass(state->device, &render_pass_info, NULL, &state->render_pass) !=
-       VK_SUCCESS) {
-        printf("Failed to create render pass!\n");
-        exit(1);
+void vulkan_record_cull(VkState *state, VkCommandBuffer command_buffer, unsigned int frame) {
+    VkBuffer indirect_buffer = state->indirect_buffers[frame];
+    vkCmdFillBuffer(command_buffer, indirect_buffer,
+                    offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+
+    VkMemoryBarrier clear_barrier = { 0 };
+    clear_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clear_barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clear_barrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clear_barrier, 0, NULL, 0,
+                         NULL);
+
+    // NOTE: Only the x and y planes of the view matter for the 2D scene.
+    CullParams params    = { 0 };
+    params.objects_count = state->instances_count;
+    params.bounds_radius = state->meshes[0].bounds_radius;
+    for(unsigned int plane = 0; plane < array_len(params.planes); ++plane) {
+        params.planes[plane][0] = view_planes[plane].x;
+        params.planes[plane][1] = view_planes[plane].y;
+        params.planes[plane][2] = view_planes[plane].z;
+        params.planes[plane][3] = view_planes[plane].d;
     }
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, state->cull_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            state->cull_pipeline_layout, 0, 1, &state->cull_sets[frame], 0, NULL);
+    vkCmdPushConstants(command_buffer, state->cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(params), &params);
+    vkCmdDispatch(command_buffer, (state->instances_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE,
+                  1, 1);
 }
 
-void vulkan_create_graphics_pipeline(VkState *state, Arena *arena) {
+void vulkan_execute_cull_pass(RenderGraph *graph, VkCommandBuffer command_buffer, void *user,
+                              unsigned int frame) {
+    unused(graph);
+    VkState *state = (VkState *)user;
+    if(state->cull_pipeline != VK_NULL_HANDLE) {
+        vulkan_record_cull(state, command_buffer, frame);
+    }
+}
 
-    // Create Graphics pipeline
+// NOTE: The state shared by every draw of the scene: viewport, scissor and the per instance vertex
+// buffer at binding 1.
+void vulkan_bind_scene_shared_state(VkState *state, VkCommandBuffer command_buffer,
+                                    unsigned int frame) {
+    VkViewport viewport = { 0 };
+    viewport.x          = 0.0f;
+    viewport.y          = 0.0f;
+    viewport.width      = (float)state->swapchain_extent.width;
+    viewport.height     = (float)state->swapchain_extent.height;
+    viewport.minDepth   = 0.0f;
+    viewport.maxDepth   = 1.0f;
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor = { 0 };
+    scissor.offset   = (VkOffset2D){ 0, 0 };
+    scissor.extent   = state->swapchain_extent;
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    VkBuffer instance_buffer = state->gpu_culling ? state->visible_buffers[frame]
+                                                  : state->instance_buffers[frame];
+    VkDeviceSize offset      = 0;
+    vkCmdBindVertexBuffers(command_buffer, 1, 1, &instance_buffer, &offset);
+}
+
+void vulkan_bind_scene_state(VkState *state, VkCommandBuffer command_buffer, unsigned int frame,
+                             VkPipeline pipeline) {
+    vulkan_bind_scene_shared_state(state, command_buffer, frame);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    Mesh *mesh          = &state->meshes[0];
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &mesh->buffer, &offset);
+    vkCmdBindIndexBuffer(command_buffer, mesh->buffer, mesh->index_offset, mesh->index_type);
+}
+
+// NOTE: The draws [first, first + count) of the draw queue, secondary command buffers don't
+// inherit any state so every slice binds its own.
+void vulkan_record_scene_slice(VkCommandBuffer command_buffer, void *user, unsigned int first,
+                               unsigned int count, unsigned int frame) {
+    VkState *state = (VkState *)user;
+    vulkan_bind_scene_shared_state(state, command_buffer, frame);
+    draw_queue_issue(&state->draw_queue, command_buffer, first, count, VK_NULL_HANDLE);
+}
+
+// NOTE: Until the shaders finish loading the frame is only cleared.
+static inline bool vulkan_scene_ready(VkState *state) {
+    return state->pipelines[0] != VK_NULL_HANDLE &&
+           (!state->gpu_culling || state->cull_pipeline != VK_NULL_HANDLE);
+}
+
+// NOTE: Records the whole scene inline. pipeline replaces the pipelines of the scene, or is
+// VK_NULL_HANDLE to draw every instance with its own.
+void vulkan_record_scene(VkState *state, VkCommandBuffer command_buffer, unsigned int frame,
+                         VkPipeline pipeline) {
+    if(state->no_instancing && !state->gpu_culling) {
+        vulkan_bind_scene_shared_state(state, command_buffer, frame);
+        draw_queue_issue(&state->draw_queue, command_buffer, 0, state->draw_queue.count,
+                         pipeline);
+        state->draws_count = state->draw_queue.count;
+        return;
+    }
+
+    vulkan_bind_scene_state(state, command_buffer, frame,
+                            pipeline != VK_NULL_HANDLE ? pipeline : state->pipelines[0]);
+    Mesh *mesh = &state->meshes[0];
+    if(state->gpu_culling) {
+        vkCmdDrawIndexedIndirect(command_buffer, state->indirect_buffers[frame], 0, 1,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+        state->draws_count = 1;
+    } else {
+        vkCmdDrawIndexed(command_buffer, mesh->indices_count, state->visible_count, 0, 0, 0);
+        state->draws_count = 1;
+    }
+}
+
+// NOTE: Same draws as the scene pass with the position only pipeline. It is always recorded
+// inline, the secondary command buffers of the recorder belong to the scene pass.
+void vulkan_execute_depth_pass(RenderGraph *graph, VkCommandBuffer command_buffer, void *user,
+                               unsigned int frame) {
+    unused(graph);
+    VkState *state = (VkState *)user;
+    if(vulkan_scene_ready(state)) {
+        vulkan_record_scene(state, command_buffer, frame, state->depth_pipeline);
+    }
+}
+
+void vulkan_execute_scene_pass(RenderGraph *graph, VkCommandBuffer command_buffer, void *user,
+                               unsigned int frame) {
+    VkState *state = (VkState *)user;
+    if(!vulkan_scene_ready(state)) {
+        return;
+    }
+
+    if(state->parallel_record) {
+        state->record_slices = command_recorder_record(
+            &state->recorder, command_buffer, state->render_pass,
+            render_graph_get_framebuffer(graph, state->scene_pass), frame, state->draw_queue.count,
+            vulkan_record_scene_slice, state);
+        state->draws_count = state->draw_queue.count;
+        return;
+    }
+    vulkan_record_scene(state, command_buffer, frame, VK_NULL_HANDLE);
+}
+
+void vulkan_execute_post_pass(RenderGraph *graph, VkCommandBuffer command_buffer, void *user,
+                              unsigned int frame) {
+    unused(frame);
+    VkState *state = (VkState *)user;
+
+    VkImageCopy region               = { 0 };
+    region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.srcSubresource.layerCount = 1;
+    region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.dstSubresource.layerCount = 1;
+    region.extent.width              = state->swapchain_extent.width;
+    region.extent.height             = state->swapchain_extent.height;
+    region.extent.depth              = 1;
+    vkCmdCopyImage(command_buffer, render_graph_get_image(graph, state->scene_color),
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   render_graph_get_image(graph, state->swapchain_resource),
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+// NOTE: The passes of a frame. The scene goes straight to the swapchain unless --post asked for
+// the offscreen target, which needs swapchain images that can be copied to. With --depth-prepass
+// the depth buffer is cleared and written by the prepass and the scene pass only reads it.
+void vulkan_create_render_graph(VkState *state) {
+    state->render_graph = arena_push_struct(&state->swapchain_arena, RenderGraph);
+    RenderGraph *graph  = state->render_graph;
+    render_graph_begin(graph, &state->swapchain_arena, state->device, &state->gpu_allocator,
+                       state->swapchain_extent);
+
+    state->swapchain_resource = render_graph_import_image(
+        graph, "swapchain", state->swapchain_images, state->swapchain_images_views,
+        state->swapchain_images_count, state->swapchain_image_format,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+    unsigned int visible  = 0;
+    unsigned int indirect = 0;
+    if(state->gpu_culling) {
+        visible  = render_graph_import_buffer(graph, "visible instances");
+        indirect = render_graph_import_buffer(graph, "indirect draw");
+        unsigned int cull_pass = render_graph_add_pass(graph, "cull", RENDER_GRAPH_PASS_COMPUTE,
+                                                       vulkan_execute_cull_pass, state);
+        render_graph_use(graph, cull_pass, visible, RENDER_GRAPH_ACCESS_STORAGE_WRITE);
+        render_graph_use(graph, cull_pass, indirect, RENDER_GRAPH_ACCESS_STORAGE_WRITE);
+    }
+
+    bool post = state->post && (state->swapchain_usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    unsigned int target = state->swapchain_resource;
+    if(post) {
+        state->scene_color = render_graph_create_image(
+            graph, "scene color", state->swapchain_image_format, VK_IMAGE_ASPECT_COLOR_BIT);
+        target = state->scene_color;
+    } else if(state->post) {
+        printf("Swapchain images can't be copied to, --post ignored\n");
+    }
+
+    state->scene_depth = render_graph_create_image(graph, "scene depth", state->depth_format,
+                                                   VK_IMAGE_ASPECT_DEPTH_BIT);
+    VkClearValue clear_depth       = { 0 };
+    clear_depth.depthStencil.depth = 1.0f;
+    if(state->depth_prepass) {
+        state->depth_pass = render_graph_add_pass(graph, "depth prepass",
+                                                  RENDER_GRAPH_PASS_GRAPHICS,
+                                                  vulkan_execute_depth_pass, state);
+        render_graph_use_attachment(graph, state->depth_pass, state->scene_depth,
+                                    RENDER_GRAPH_ACCESS_DEPTH_ATTACHMENT,
+                                    VK_ATTACHMENT_LOAD_OP_CLEAR, clear_depth);
+        if(state->gpu_culling) {
+            render_graph_use(graph, state->depth_pass, visible, RENDER_GRAPH_ACCESS_VERTEX_READ);
+            render_graph_use(graph, state->depth_pass, indirect,
+                             RENDER_GRAPH_ACCESS_INDIRECT_READ);
+        }
+    }
+
+    VkClearValue clear_color = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
+    state->scene_pass = render_graph_add_pass(graph, "scene", RENDER_GRAPH_PASS_GRAPHICS,
+                                              vulkan_execute_scene_pass, state);
+    render_graph_use_attachment(graph, state->scene_pass, target,
+                                RENDER_GRAPH_ACCESS_COLOR_ATTACHMENT, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                                clear_color);
+    if(state->depth_prepass) {
+        render_graph_use(graph, state->scene_pass, state->scene_depth,
+                         RENDER_GRAPH_ACCESS_DEPTH_READ);
+    } else {
+        render_graph_use_attachment(graph, state->scene_pass, state->scene_depth,
+                                    RENDER_GRAPH_ACCESS_DEPTH_ATTACHMENT,
+                                    VK_ATTACHMENT_LOAD_OP_CLEAR, clear_depth);
+    }
+    if(state->parallel_record) {
+        render_graph_set_secondary(graph, state->scene_pass);
+    }
+    if(state->gpu_culling) {
+        render_graph_use(graph, state->scene_pass, visible, RENDER_GRAPH_ACCESS_VERTEX_READ);
+        render_graph_use(graph, state->scene_pass, indirect, RENDER_GRAPH_ACCESS_INDIRECT_READ);
+    }
+
+    if(post) {
+        unsigned int post_pass = render_graph_add_pass(graph, "post", RENDER_GRAPH_PASS_TRANSFER,
+                                                       vulkan_execute_post_pass, state);
+        render_graph_use(graph, post_pass, state->scene_color, RENDER_GRAPH_ACCESS_TRANSFER_SRC);
+        render_graph_use(graph, post_pass, state->swapchain_resource,
+                         RENDER_GRAPH_ACCESS_TRANSFER_DST);
+    }
+
+    render_graph_compile(graph);
+    state->render_pass = render_graph_get_render_pass(graph, state->scene_pass);
+    state->depth_render_pass =
+        state->depth_prepass ? render_graph_get_render_pass(graph, state->depth_pass)
+                             : VK_NULL_HANDLE;
+}
 
-    File vert_code = read_entire_file(arena, "./res/shaders/vert.spv");
-    File frag_code = read_entire_file(arena, "./res/shaders/frag.spv");
+// NOTE: depth_code is the position only vertex shader of the depth prepass, or NULL without it.
+void vulkan_create_graphics_pipeline(VkState *state, File *vert_code, File *frag_code,
+                                     File *depth_code) {
 
-    VkShaderModule vert_module = vulkan_create_shader_module(state->device, &vert_code);
-    VkShaderModule frag_module = vulkan_create_shader_module(state->device, &frag_code);
+    // Create Graphics pipeline
+
+    VkShaderModule vert_module = vulkan_create_shader_module(state->device, vert_code);
+    VkShaderModule frag_module = vulkan_create_shader_module(state->device, frag_code);
 
     VkPipelineShaderStageCreateInfo vert_shader_stage_info = { 0 };
     vert_shader_stage_info.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -633,14 +1302,15 @@ void vulkan_create_graphics_pipeline(VkState *state, Arena *arena) {
     dynamic_state.dynamicStateCount = array_len(dynamic_states);
     dynamic_state.pDynamicStates    = dynamic_states;
 
-    VkVertexInputBindingDescription vertex_input_desc = vertex_get_binding_description();
-    VkVertexInputAttributeDescription vertex_attr_desc[2];
+    VkVertexInputBindingDescription vertex_input_desc[] = { vertex_get_binding_description(),
+                                                            instance_get_binding_description() };
+    VkVertexInputAttributeDescription vertex_attr_desc[VERTEX_ATTRIBUTES_COUNT];
     vertex_get_attribute_desc(vertex_attr_desc);
 
     VkPipelineVertexInputStateCreateInfo vertex_input_info = { 0 };
     vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount   = 1;
-    vertex_input_info.pVertexBindingDescriptions      = &vertex_input_desc;
+    vertex_input_info.vertexBindingDescriptionCount   = array_len(vertex_input_desc);
+    vertex_input_info.pVertexBindingDescriptions      = vertex_input_desc;
     vertex_input_info.vertexAttributeDescriptionCount = array_len(vertex_attr_desc);
     vertex_input_info.pVertexAttributeDescriptions    = vertex_attr_desc;
 
@@ -706,6 +1376,31 @@ void vulkan_create_graphics_pipeline(VkState *state, Arena *arena) {
     color_blending.blendConstants[2] = 0.0f;
     color_blending.blendConstants[3] = 0.0f;
 
+    // NOTE: Second scene pipeline, identical apart from adding its color to the target.
+    VkPipelineColorBlendAttachmentState additive_blend_attachment = color_blend_attachment;
+    additive_blend_attachment.blendEnable                         = VK_TRUE;
+    additive_blend_attachment.srcColorBlendFactor                 = VK_BLEND_FACTOR_ONE;
+    additive_blend_attachment.dstColorBlendFactor                 = VK_BLEND_FACTOR_ONE;
+    additive_blend_attachment.colorBlendOp                        = VK_BLEND_OP_ADD;
+    additive_blend_attachment.srcAlphaBlendFactor                 = VK_BLEND_FACTOR_ONE;
+    additive_blend_attachment.dstAlphaBlendFactor                 = VK_BLEND_FACTOR_ZERO;
+    additive_blend_attachment.alphaBlendOp                        = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo additive_blending = color_blending;
+    additive_blending.pAttachments                        = &additive_blend_attachment;
+
+    // NOTE: With the prepass the depth is final by the time the scene pass runs, so the scene only
+    // shades the fragments that match it and leaves the depth buffer alone. The fragment shader
+    // neither discards nor writes depth, so the test can run before it (early-Z) either way.
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = { 0 };
+    depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable       = VK_TRUE;
+    depth_stencil.depthWriteEnable      = state->depth_prepass ? VK_FALSE : VK_TRUE;
+    depth_stencil.depthCompareOp        = state->depth_prepass ? VK_COMPARE_OP_EQUAL
+                                                               : VK_COMPARE_OP_LESS;
+    depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    depth_stencil.stencilTestEnable     = VK_FALSE;
+
     // Create Pipeline layout
     VkPipelineLayout pipeline_layout;
     VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
@@ -730,7 +1425,7 @@ void vulkan_create_graphics_pipeline(VkState *state, Arena *arena) {
     pipeline_info.pViewportState               = &viewport_state;
     pipeline_info.pRasterizationState          = &rasterizer;
     pipeline_info.pMultisampleState            = &multisampling;
-    pipeline_info.pDepthStencilState           = NULL;
+    pipeline_info.pDepthStencilState           = &depth_stencil;
     pipeline_info.pColorBlendState             = &color_blending;
     pipeline_info.pDynamicState                = &dynamic_state;
     pipeline_info.layout                       = pipeline_layout;
@@ -739,43 +1434,70 @@ void vulkan_create_graphics_pipeline(VkState *state, Arena *arena) {
     pipeline_info.basePipelineHandle           = VK_NULL_HANDLE;
     pipeline_info.basePipelineIndex            = -1;
 
-    if(vkCreateGraphicsPipelines(state->device, VK_NULL_HANDLE, 1, &pipeline_info, NULL,
-                                 &state->pipeline) != VK_SUCCESS) {
+    VkGraphicsPipelineCreateInfo pipeline_infos[SCENE_PIPELINES_COUNT + 1] = { pipeline_info,
+                                                                               pipeline_info };
+    pipeline_infos[1].pColorBlendState = &additive_blending;
+    unsigned int pipelines_count       = SCENE_PIPELINES_COUNT;
+
+    // NOTE: The depth prepass pipeline only has the vertex stage and only fetches positions, it
+    // renders into a pass without color attachments.
+    VkVertexInputAttributeDescription depth_attr_desc[] = {
+        vertex_attr_desc[VERTEX_LOC_POS], vertex_attr_desc[INSTANCE_LOC_OFFSET],
+        vertex_attr_desc[INSTANCE_LOC_SCALE], vertex_attr_desc[INSTANCE_LOC_DEPTH]
+    };
+    VkPipelineVertexInputStateCreateInfo depth_vertex_input = vertex_input_info;
+    depth_vertex_input.vertexAttributeDescriptionCount      = array_len(depth_attr_desc);
+    depth_vertex_input.pVertexAttributeDescriptions         = depth_attr_desc;
+
+    VkPipelineDepthStencilStateCreateInfo prepass_depth_stencil = depth_stencil;
+    prepass_depth_stencil.depthWriteEnable                      = VK_TRUE;
+    prepass_depth_stencil.depthCompareOp                        = VK_COMPARE_OP_LESS;
+
+    VkPipelineColorBlendStateCreateInfo no_blending = color_blending;
+    no_blending.attachmentCount                     = 0;
+    no_blending.pAttachments                        = NULL;
+
+    VkPipelineShaderStageCreateInfo depth_shader_stage_info = vert_shader_stage_info;
+    if(depth_code != NULL) {
+        depth_shader_stage_info.module =
+            vulkan_create_shader_module(state->device, depth_code);
+
+        VkGraphicsPipelineCreateInfo *depth_info = &pipeline_infos[pipelines_count++];
+        *depth_info                              = pipeline_info;
+        depth_info->stageCount                   = 1;
+        depth_info->pStages                      = &depth_shader_stage_info;
+        depth_info->pVertexInputState            = &depth_vertex_input;
+        depth_info->pDepthStencilState           = &prepass_depth_stencil;
+        depth_info->pColorBlendState             = &no_blending;
+        depth_info->renderPass                   = state->depth_render_pass;
+    }
+
+    VkPipeline pipelines[SCENE_PIPELINES_COUNT + 1];
+    Uint64 start = SDL_GetPerformanceCounter();
+    if(vkCreateGraphicsPipelines(state->device, state->pipeline_cache.cache, pipelines_count,
+                                 pipeline_infos, NULL, pipelines) != VK_SUCCESS) {
         printf("Failed to create graphics pipeline!\n");
         exit(1);
     }
-}
-
-void vulkan_create_framebuffer(VkState *state, Arena *arena) {
-
-    state->framebuffers_count = state->swapchain_images_count;
-    state->framebuffers       = (VkFramebuffer *)arena_push(
-        arena, sizeof(VkFramebuffer) * state->swapchain_images_count, 1);
+    pipeline_cache_created(&state->pipeline_cache, start, "graphics pipelines");
+    for(unsigned int i = 0; i < SCENE_PIPELINES_COUNT; ++i) {
+        state->pipelines[i] = pipelines[i];
+    }
+    if(depth_code != NULL) {
+        state->depth_pipeline = pipelines[SCENE_PIPELINES_COUNT];
+    }
+    state->pipeline_layout = pipeline_layout;
 
-    for(unsigned int image_index = 0; image_index < state->swapchain_images_count; ++image_index) {
-        VkImageView image_view = state->swapchain_images_views[image_index];
-
-        VkFramebufferCreateInfo framebuffer_info = { 0 };
-        framebuffer_info.sType                   = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebuffer_info.renderPass              = state->render_pass;
-        framebuffer_info.attachmentCount         = 1;
-        framebuffer_info.pAttachments            = &image_view;
-        framebuffer_info.width                   = state->swapchain_extent.width;
-        framebuffer_info.height                  = state->swapchain_extent.height;
-        framebuffer_info.layers                  = 1;
-
-        if(vkCreateFramebuffer(state->device, &framebuffer_info, NULL,
-                               &state->framebuffers[image_index]) != VK_SUCCESS) {
-            printf("Failed to create framebuffer!\n");
-            exit(1);
-        }
+    // NOTE: Pipelines don't keep their shader modules alive, nothing in flight uses them.
+    vkDestroyShaderModule(state->device, vert_module, NULL);
+    vkDestroyShaderModule(state->device, frag_module, NULL);
+    if(depth_code != NULL) {
+        vkDestroyShaderModule(state->device, depth_shader_stage_info.module, NULL);
     }
 }
 
 void vulkan_cleanup_swapchain(VkState *state) {
-    for(unsigned int buffer_index = 0; buffer_index < state->framebuffers_count; ++buffer_index) {
-        vkDestroyFramebuffer(state->device, state->framebuffers[buffer_index], NULL);
-    }
+    render_graph_destroy(state->render_graph);
 
     for(unsigned int image_index = 0; image_index < state->swapchain_images_count; ++image_index) {
         vkDestroyImageView(state->device, state->swapchain_images_views[image_index], NULL);
@@ -784,20 +1506,60 @@ void vulkan_cleanup_swapchain(VkState *state) {
     vkDestroySwapchainKHR(state->device, state->swapchain, NULL);
 }
 
-void vulkan_recreate_swapchain(VkState *state, Arena *arena, SDL_Window *window) {
+// NOTE: The render graph of a replaced swapchain, pushed on the swapchain arena it lives in.
+typedef struct RetiredSwapchain {
+    VkState *state;
+    RenderGraph *render_graph;
+    Arena arena;
+} RetiredSwapchain;
+
+static void vulkan_destroy_retired_swapchain(void *data) {
+    RetiredSwapchain *retired = data;
+    VkState *state            = retired->state;
+    Arena arena               = retired->arena;
+    render_graph_destroy(retired->render_graph);
+    arena_clear(&arena);
+    if(state->spare_swapchain_arenas_count < SWAPCHAIN_SPARE_ARENAS) {
+        state->spare_swapchain_arenas[state->spare_swapchain_arenas_count++] = arena;
+    } else {
+        arena_destroy(&arena);
+    }
+}
+
+// NOTE: The old swapchain is passed to the new one and released with its views and graph instead
+// of waiting for the device to go idle, so a resize doesn't stall the frames in flight.
+void vulkan_recreate_swapchain(VkState *state, Arena *scratch, SDL_Window *window) {
 
     while(SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED) {
         SDL_Event e;
         SDL_WaitEvent(&e);
     }
 
-    vkDeviceWaitIdle(state->device);
-
-    vulkan_cleanup_swapchain(state);
+    VkSwapchainKHR old_swapchain = state->swapchain;
+    for(unsigned int image_index = 0; image_index < state->swapchain_images_count; ++image_index) {
+        VkImageView view = state->swapchain_images_views[image_index];
+        vulkan_release(state, (Deletion){ .type = DELETION_IMAGE_VIEW, .image_view = view });
+    }
+    vulkan_release(state, (Deletion){ .type = DELETION_SWAPCHAIN, .swapchain = old_swapchain });
+
+    RetiredSwapchain *retired = arena_push_struct(&state->swapchain_arena, RetiredSwapchain);
+    retired->state            = state;
+    retired->render_graph     = state->render_graph;
+    retired->arena            = state->swapchain_arena;
+    vulkan_release(state, (Deletion){ .type     = DELETION_CALLBACK,
+                                      .callback = { vulkan_destroy_retired_swapchain, retired } });
+    ++state->swapchains_recreated;
+
+    if(state->spare_swapchain_arenas_count > 0) {
+        state->swapchain_arena =
+            state->spare_swapchain_arenas[--state->spare_swapchain_arenas_count];
+    } else {
+        state->swapchain_arena = arena_create_virtual(SWAPCHAIN_ARENA_SIZE, 0);
+    }
 
-    vulkan_create_swapchain(state, arena, window);
-    vulkan_create_images_views(state, arena);
-    vulkan_create_framebuffer(state, arena);
+    vulkan_create_swapchain(state, scratch, window, old_swapchain);
+    vulkan_create_images_views(state, &state->swapchain_arena);
+    vulkan_create_render_graph(state);
 }
 
 void vulkan_create_command_pool(VkState *state) {
@@ -818,7 +1580,7 @@ void vulkan_create_command_buffer(VkState *state) {
     alloc_info.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     alloc_info.commandPool                 = state->command_pool;
     alloc_info.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandBufferCount          = array_len(state->command_buffers);
+    alloc_info.commandBufferCount          = state->frames_in_flight;
 
     if(vkAllocateCommandBuffers(state->device, &alloc_info, state->command_buffers) != VK_SUCCESS) {
         printf("Failed to allocate command buffers!\n");
@@ -826,7 +1588,8 @@ void vulkan_create_command_buffer(VkState *state) {
     }
 }
 
-void recordCommandBuffer(VkState *state, VkCommandBuffer command_buffer, uint32_t image_index) {
+void recordCommandBuffer(VkState *state, VkCommandBuffer command_buffer, uint32_t image_index,
+                         unsigned int frame) {
     VkCommandBufferBeginInfo begin_info = { 0 };
     begin_info.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     begin_info.flags                    = 0;
@@ -837,45 +1600,138 @@ void recordCommandBuffer(VkState *state, VkCommandBuffer command_buffer, uint32_
         exit(1);
     }
 
-    VkRenderPassBeginInfo render_pass_info = { 0 };
-    render_pass_info.sType                 = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_pass_info.renderPass            = state->render_pass;
-    render_pass_info.framebuffer           = state->framebuffers[image_index];
-    render_pass_info.renderArea.offset     = (VkOffset2D){ 0, 0 };
-    render_pass_info.renderArea.extent     = state->swapchain_extent;
-
-    VkClearValue clear_color         = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues    = &clear_color;
+    uint32_t first_timestamp = frame * FRAME_TIMESTAMPS;
+    if(state->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(command_buffer, state->timestamp_pool, first_timestamp,
+                            FRAME_TIMESTAMPS);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            state->timestamp_pool, first_timestamp);
+    }
+    if(!state->use_transfer_queue) {
+        upload_ring_flush(&state->upload_ring, command_buffer, frame, false);
+    }
+    if(state->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, state->timestamp_pool,
+                            first_timestamp + 1);
+    }
+    if(state->statistics_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(command_buffer, state->statistics_pool, frame, 1);
+        vkCmdBeginQuery(command_buffer, state->statistics_pool, frame, 0);
+    }
+    render_graph_execute(state->render_graph, command_buffer, image_index, frame);
+    if(state->statistics_pool != VK_NULL_HANDLE) {
+        vkCmdEndQuery(command_buffer, state->statistics_pool, frame);
+    }
+    if(state->timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            state->timestamp_pool, first_timestamp + 2);
+    }
 
-    vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        printf("Failed to record command buffer!\n");
+        exit(1);
+    }
+}
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state->pipeline);
+// NOTE: Allocates every per frame array of the state, frames_in_flight entries each, and the
+// frame arenas. The Vulkan objects in them are created later.
+void vulkan_create_frames(VkState *state, Arena *arena, unsigned int frames_in_flight) {
+    assert(frames_in_flight >= 1 && frames_in_flight <= MAX_FRAMES_IN_FLIGHT);
+    state->frames_in_flight = frames_in_flight;
+    state->frame_arenas     = arena_push_array(arena, Arena, frames_in_flight);
+    for(unsigned int i = 0; i < frames_in_flight; ++i) {
+        state->frame_arenas[i] = arena_create_virtual(FRAME_ARENA_SIZE, 0);
+    }
+    state->command_buffers            = arena_push_array(arena, VkCommandBuffer, frames_in_flight);
+    state->image_available_semaphores = arena_push_array(arena, VkSemaphore, frames_in_flight);
+    state->render_finished_semaphores = arena_push_array(arena, VkSemaphore, frames_in_flight);
+    state->in_flight_fences           = arena_push_array(arena, VkFence, frames_in_flight);
+    state->statistics_pending         = arena_push_array(arena, bool, frames_in_flight);
+    state->frame_input_times          = arena_push_array(arena, Uint64, frames_in_flight);
+    state->frame_numbers              = arena_push_array(arena, uint64_t, frames_in_flight);
+    state->timestamps_pending         = arena_push_array(arena, bool, frames_in_flight);
+    state->transfer_command_buffers   = arena_push_array(arena, VkCommandBuffer, frames_in_flight);
+    state->scene_buffers              = arena_push_array(arena, VkBuffer, frames_in_flight);
+    state->scene_buffers_memory       = arena_push_array(arena, GpuAllocation, frames_in_flight);
+    state->instance_buffers           = arena_push_array(arena, VkBuffer, frames_in_flight);
+    state->instance_buffers_memory    = arena_push_array(arena, GpuAllocation, frames_in_flight);
+    state->visible_buffers            = arena_push_array(arena, VkBuffer, frames_in_flight);
+    state->visible_buffers_memory     = arena_push_array(arena, GpuAllocation, frames_in_flight);
+    state->indirect_buffers           = arena_push_array(arena, VkBuffer, frames_in_flight);
+    state->indirect_buffers_memory    = arena_push_array(arena, GpuAllocation, frames_in_flight);
+    state->cull_sets                  = arena_push_array(arena, VkDescriptorSet, frames_in_flight);
+}
 
-    VkViewport viewport = { 0 };
-    viewport.x          = 0.0f;
-    viewport.y          = 0.0f;
-    viewport.width      = (float)state->swapchain_extent.width;
-    viewport.height     = (float)state->swapchain_extent.height;
-    viewport.minDepth   = 0.0f;
-    viewport.maxDepth   = 1.0f;
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+// NOTE: One query per frame slot. While the query is active the recorder's secondary command
+// buffers have to declare it, which needs inheritedQueries.
+void vulkan_create_statistics_pool(VkState *state) {
+    if(!state->device_features.pipelineStatisticsQuery ||
+       (state->parallel_record && !state->device_features.inheritedQueries)) {
+        printf("Pipeline statistics queries not supported, fragment counts disabled\n");
+        return;
+    }
 
-    VkRect2D scissor = { 0 };
-    scissor.offset   = (VkOffset2D){ 0, 0 };
-    scissor.extent   = state->swapchain_extent;
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    VkQueryPoolCreateInfo pool_info = { 0 };
+    pool_info.sType                 = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType             = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    pool_info.queryCount            = state->frames_in_flight;
+    pool_info.pipelineStatistics    = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    if(vkCreateQueryPool(state->device, &pool_info, NULL, &state->statistics_pool) !=
+       VK_SUCCESS) {
+        printf("Failed to create query pool!\n");
+        exit(1);
+    }
+    if(state->parallel_record) {
+        state->recorder.pipeline_statistics = pool_info.pipelineStatistics;
+    }
+}
 
-    VkDeviceSize offsets[] = { 0 };
-    vkCmdBindVertexBuffers(command_buffer, 0, 1, &state->vertex_buffer, offsets);
+void vulkan_create_timestamp_pool(VkState *state) {
+    if(state->graphics_timestamp_bits == 0) {
+        printf("Timestamps not supported on the graphics queue, GPU frame times disabled\n");
+        return;
+    }
 
-    vkCmdDraw(command_buffer, array_len(vertices), 1, 0, 0);
+    VkQueryPoolCreateInfo pool_info = { 0 };
+    pool_info.sType                 = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType             = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount            = state->frames_in_flight * FRAME_TIMESTAMPS;
+    if(vkCreateQueryPool(state->device, &pool_info, NULL, &state->timestamp_pool) !=
+       VK_SUCCESS) {
+        printf("Failed to create query pool!\n");
+        exit(1);
+    }
+}
 
-    vkCmdEndRenderPass(command_buffer);
+// NOTE: Call once the fence of the frame signaled.
+void vulkan_read_timestamps(VkState *state, unsigned int frame) {
+    if(!state->timestamps_pending[frame]) {
+        return;
+    }
+    state->timestamps_pending[frame]      = false;
+    uint64_t timestamps[FRAME_TIMESTAMPS] = { 0 };
+    if(vkGetQueryPoolResults(state->device, state->timestamp_pool, frame * FRAME_TIMESTAMPS,
+                             FRAME_TIMESTAMPS, sizeof(timestamps), timestamps,
+                             sizeof(timestamps[0]), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        double ns_to_ms = (double)state->timestamp_period / 1e6;
+        state->gpu_upload_ms_total += (double)(timestamps[1] - timestamps[0]) * ns_to_ms;
+        state->gpu_frame_ms_total += (double)(timestamps[2] - timestamps[0]) * ns_to_ms;
+        ++state->frames_timed;
+    }
+}
 
-    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-        printf("Failed to record command buffer!\n");
-        exit(1);
+// NOTE: Call once the fence of the frame signaled.
+void vulkan_read_statistics(VkState *state, unsigned int frame) {
+    if(!state->statistics_pending[frame]) {
+        return;
+    }
+    state->statistics_pending[frame] = false;
+    uint64_t fragment_invocations    = 0;
+    if(vkGetQueryPoolResults(state->device, state->statistics_pool, frame, 1,
+                             sizeof(fragment_invocations), &fragment_invocations,
+                             sizeof(fragment_invocations), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        state->fragment_invocations_total += fragment_invocations;
+        ++state->frames_queried;
     }
 }
 
@@ -887,63 +1743,378 @@ void vulkan_create_sync_objs(VkState *state) {
     fence_info.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fence_info.flags             = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for(unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
         if(vkCreateSemaphore(state->device, &semaphore_info, NULL,
                              &state->image_available_semaphores[i]) != VK_SUCCESS ||
            vkCreateSemaphore(state->device, &semaphore_info, NULL,
                              &state->render_finished_semaphores[i]) != VK_SUCCESS ||
-           vkCreateFence(state->device, &fence_info, NULL, &state->in_flight_fences[i]) !=
-               VK_SUCCESS) {
+           (!state->timeline && vkCreateFence(state->device, &fence_info, NULL,
+                                              &state->in_flight_fences[i]) != VK_SUCCESS)) {
             printf("Failed to create semaphores!\n");
             exit(1);
         }
     }
+
+    if(state->timeline) {
+        VkSemaphoreTypeCreateInfo type_info = { 0 };
+        type_info.sType                     = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        type_info.semaphoreType             = VK_SEMAPHORE_TYPE_TIMELINE;
+        type_info.initialValue              = 0;
+
+        VkSemaphoreCreateInfo timeline_info = semaphore_info;
+        timeline_info.pNext                 = &type_info;
+        if(vkCreateSemaphore(state->device, &timeline_info, NULL, &state->frame_timeline) !=
+           VK_SUCCESS) {
+            printf("Failed to create timeline semaphore!\n");
+            exit(1);
+        }
+    }
 }
 
-void vulkan_draw_frame(VkState *state, Arena *arena, SDL_Window *window, VkQueue present_queue,
-                       VkQueue graphics_queue) {
+void vulkan_create_transfer_engine(VkState *state) {
+    if(!state->use_transfer_queue) {
+        return;
+    }
+    vkGetDeviceQueue(state->device, state->transfer_queue_index, 0, &state->transfer_queue);
+
+    VkCommandPoolCreateInfo pool_info = { 0 };
+    pool_info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags                   = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex        = state->transfer_queue_index;
+    if(vkCreateCommandPool(state->device, &pool_info, NULL, &state->transfer_command_pool) !=
+       VK_SUCCESS) {
+        printf("Failed to create transfer command pool!\n");
+        exit(1);
+    }
+
+    VkCommandBufferAllocateInfo alloc_info = { 0 };
+    alloc_info.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool                 = state->transfer_command_pool;
+    alloc_info.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount          = state->frames_in_flight;
+    if(vkAllocateCommandBuffers(state->device, &alloc_info, state->transfer_command_buffers) !=
+       VK_SUCCESS) {
+        printf("Failed to allocate transfer command buffers!\n");
+        exit(1);
+    }
+
+    VkSemaphoreTypeCreateInfo type_info = { 0 };
+    type_info.sType                     = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType             = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue              = 0;
+
+    VkSemaphoreCreateInfo semaphore_info = { 0 };
+    semaphore_info.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext                 = &type_info;
+    if(vkCreateSemaphore(state->device, &semaphore_info, NULL, &state->transfer_timeline) !=
+       VK_SUCCESS) {
+        printf("Failed to create timeline semaphore!\n");
+        exit(1);
+    }
+}
+
+// NOTE: Submits the pending uploads to the transfer queue and returns the semaphore the frame has
+// to wait on, VK_NULL_HANDLE when the uploads go with the frame or there are none. The slot's
+// command buffer is free again since the frame that used it waited for its transfer. The copies
+// wait for the last frame that may still read their destinations, which for a buffer per frame
+// slot is the slot's previous frame and already done.
+VkSemaphore vulkan_submit_uploads(VkState *state, unsigned int frame) {
+    if(!state->use_transfer_queue) {
+        return VK_NULL_HANDLE;
+    }
+    UploadRing *ring = &state->upload_ring;
+    if(ring->copies_count == 0) {
+        upload_ring_flush(ring, VK_NULL_HANDLE, frame, true);
+        return VK_NULL_HANDLE;
+    }
+    uint64_t read_frame = ring->read_frame;
+
+    VkCommandBuffer command_buffer      = state->transfer_command_buffers[frame];
+    VkCommandBufferBeginInfo begin_info = { 0 };
+    begin_info.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkResetCommandBuffer(command_buffer, 0);
+    if(vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        printf("Failed to begin recording command buffer!\n");
+        exit(1);
+    }
+    upload_ring_flush(ring, command_buffer, frame, true);
+    if(vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        printf("Failed to record command buffer!\n");
+        exit(1);
+    }
+
+    uint64_t signal_value           = ++state->transfer_value;
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = { 0 };
+    timeline_info.sType                         = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount       = 1;
+    timeline_info.pWaitSemaphoreValues          = &read_frame;
+    timeline_info.signalSemaphoreValueCount     = 1;
+    timeline_info.pSignalSemaphoreValues        = &signal_value;
+
+    VkSubmitInfo submit_info         = { 0 };
+    submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext                = &timeline_info;
+    submit_info.waitSemaphoreCount   = 1;
+    submit_info.pWaitSemaphores      = &state->frame_timeline;
+    submit_info.pWaitDstStageMask    = &wait_stage;
+    submit_info.commandBufferCount   = 1;
+    submit_info.pCommandBuffers      = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores    = &state->transfer_timeline;
+    if(vkQueueSubmit(state->transfer_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+        printf("Failed to submit uploads!\n");
+        exit(1);
+    }
+    return state->transfer_timeline;
+}
+
+// NOTE: The draw of a visible instance once it was copied to slot of the instance buffer.
+static void scene_queue_draw(VkState *state, uint32_t slot, uint32_t instance) {
+    SceneMaterial material = state->materials[instance];
+    Mesh *mesh             = &state->meshes[material.mesh];
+    DrawPacket packet      = { 0 };
+    packet.pipeline        = state->pipelines[material.pipeline];
+    packet.vertex_buffer   = mesh->buffer;
+    packet.index_buffer    = mesh->buffer;
+    packet.index_offset    = mesh->index_offset;
+    packet.index_type      = mesh->index_type;
+    packet.indices_count   = mesh->indices_count;
+    packet.first_instance  = slot;
+
+    float depth  = state->instances[instance].depth;
+    uint64_t key = draw_key(0, material.pipeline, material.mesh, draw_depth_bucket(depth));
+    draw_queue_set(&state->draw_queue, slot, key, &packet);
+}
+
+// NOTE: CPU culling is split in chunks of CULL_JOB_SIZE spheres. Every chunk writes its visible
+// indices to its own range of the visible array, once the counts are prefix summed each chunk
+// queues its draws and copies its instances straight to their place in the instance buffer. The
+// BVH query is a single chunk. Only the copy touches memory the GPU reads, everything before it
+// runs without waiting for the frame slot's fence.
+typedef struct SceneCullJob {
+    VkState *state;
+    unsigned int chunks_count;
+    unsigned int *visible;
+    unsigned int *counts;
+    unsigned int *offsets;
+    Instance *instances;
+} SceneCullJob;
+
+static void scene_cull_job(void *data, unsigned int first, unsigned int count) {
+    SceneCullJob *job = (SceneCullJob *)data;
+    VkState *state    = job->state;
+    for(unsigned int chunk = first; chunk < first + count; ++chunk) {
+        unsigned int start = chunk * CULL_JOB_SIZE;
+        job->counts[chunk] = cull_spheres_range(state->cull_path, &state->cull_bounds, start,
+                                                CULL_JOB_SIZE, view_planes, job->visible + start);
+    }
+}
+
+static void scene_queue_job(void *data, unsigned int first, unsigned int count) {
+    SceneCullJob *job = (SceneCullJob *)data;
+    VkState *state    = job->state;
+    for(unsigned int chunk = first; chunk < first + count; ++chunk) {
+        unsigned int *visible = job->visible + chunk * CULL_JOB_SIZE;
+        for(unsigned int i = 0; i < job->counts[chunk]; ++i) {
+            scene_queue_draw(state, job->offsets[chunk] + i, visible[i]);
+        }
+    }
+}
 
-    VkCommandBuffer command_buffer        = state->command_buffers[state->current_frame];
-    VkFence in_flight_fence               = state->in_flight_fences[state->current_frame];
-    VkSemaphore image_available_semaphore = state->image_available_semaphores[state->current_frame];
-    VkSemaphore render_finished_semaphore = state->render_finished_semaphores[state->current_frame];
+static void scene_copy_job(void *data, unsigned int first, unsigned int count) {
+    SceneCullJob *job = (SceneCullJob *)data;
+    VkState *state    = job->state;
+    for(unsigned int chunk = first; chunk < first + count; ++chunk) {
+        unsigned int *visible = job->visible + chunk * CULL_JOB_SIZE;
+        Instance *instances   = job->instances + job->offsets[chunk];
+        for(unsigned int i = 0; i < job->counts[chunk]; ++i) {
+            instances[i] = state->instances[visible[i]];
+        }
+    }
+}
 
-    state->current_frame = (state->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+// NOTE: Culls the scene and, with --no-instancing, builds and sorts the draw queue.
+void scene_cull(VkState *state, Arena *scratch, SceneCullJob *job) {
+    unsigned int capacity = state->cull_bounds.capacity;
+    job->state            = state;
+    job->visible          = arena_push_array_no_zero(scratch, unsigned int, capacity);
+    if(state->use_bvh) {
+        job->chunks_count = 1;
+        job->counts       = arena_push_array_no_zero(scratch, unsigned int, 1);
+        job->counts[0]    = bvh_query_frustum(&state->bvh, view_planes, CULL_PLANES_COUNT,
+                                              job->visible, capacity);
+    } else {
+        job->chunks_count = (state->cull_bounds.count + CULL_JOB_SIZE - 1) / CULL_JOB_SIZE;
+        job->counts       = arena_push_array_no_zero(scratch, unsigned int, job->chunks_count);
+        job_parallel_for(state->jobs, job->chunks_count, 1, scene_cull_job, job);
+    }
+
+    unsigned int visible_count = 0;
+    job->offsets = arena_push_array_no_zero(scratch, unsigned int, job->chunks_count);
+    for(unsigned int chunk = 0; chunk < job->chunks_count; ++chunk) {
+        job->offsets[chunk] = visible_count;
+        visible_count += job->counts[chunk];
+    }
+    state->visible_count = visible_count;
+    if(!state->no_instancing) {
+        return;
+    }
+
+    draw_queue_begin(&state->draw_queue, scratch, visible_count);
+    job_parallel_for(state->jobs, job->chunks_count, 1, scene_queue_job, job);
+    state->binds_unsorted_total += draw_queue_count_binds(&state->draw_queue);
+    if(state->sort_draws) {
+        Uint64 sort_start = SDL_GetPerformanceCounter();
+        draw_queue_sort(&state->draw_queue);
+        state->sort_ms_total += (double)(SDL_GetPerformanceCounter() - sort_start) * 1000.0 /
+                                (double)SDL_GetPerformanceFrequency();
+        state->sort_passes = state->draw_queue.passes_count;
+    }
+}
+
+// NOTE: The fence of the frame slot must have been waited on.
+void scene_copy(VkState *state, SceneCullJob *job, unsigned int frame) {
+    job->instances = (Instance *)state->instance_buffers_memory[frame].mapped;
+    job_parallel_for(state->jobs, job->chunks_count, 1, scene_copy_job, job);
+}
+
+// NOTE: Waits for the frame that used current_frame's slot before, once per frame no matter how
+// often it is called, and collects what the GPU reported for it. The timeline also tells how far
+// the GPU got past that frame, so later frames' deletions can go too.
+void vulkan_wait_frame(VkState *state) {
+    if(state->frame_waited) {
+        return;
+    }
+    unsigned int frame = state->current_frame;
+    Uint64 wait_start  = SDL_GetPerformanceCounter();
+    uint64_t completed = state->frame_numbers[frame];
+    if(state->timeline) {
+        VkSemaphoreWaitInfo wait_info = { 0 };
+        wait_info.sType               = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount      = 1;
+        wait_info.pSemaphores         = &state->frame_timeline;
+        wait_info.pValues             = &state->frame_numbers[frame];
+        state->wait_semaphores(state->device, &wait_info, UINT64_MAX);
+        state->get_semaphore_counter_value(state->device, state->frame_timeline, &completed);
+    } else {
+        vkWaitForFences(state->device, 1, &state->in_flight_fences[frame], VK_TRUE, UINT64_MAX);
+    }
+    state->fence_wait_ms_total += (double)(SDL_GetPerformanceCounter() - wait_start) * 1000.0 /
+                                  (double)SDL_GetPerformanceFrequency();
+    state->frame_waited = true;
+
+    state->completed_frame = max(state->completed_frame, completed);
+    deletion_queue_collect(&state->deletion_queue, state->completed_frame);
+
+    vulkan_read_statistics(state, frame);
+    vulkan_read_timestamps(state, frame);
+    Uint64 input_time = state->frame_input_times[frame];
+    if(input_time != 0) {
+        double latency_ms = (double)(SDL_GetPerformanceCounter() - input_time) * 1000.0 /
+                            (double)SDL_GetPerformanceFrequency();
+        state->latency_ms_total += latency_ms;
+        state->latency_ms_max = max(state->latency_ms_max, latency_ms);
+        ++state->latency_samples;
+        state->frame_input_times[frame] = 0;
+    }
+}
+
+void vulkan_draw_frame(VkState *state, SDL_Window *window, VkQueue present_queue,
+                       VkQueue graphics_queue) {
+
+    unsigned int frame                    = state->current_frame;
+    VkCommandBuffer command_buffer        = state->command_buffers[frame];
+    VkFence in_flight_fence               = state->in_flight_fences[frame];
+    VkSemaphore image_available_semaphore = state->image_available_semaphores[frame];
+    VkSemaphore render_finished_semaphore = state->render_finished_semaphores[frame];
+
+    // NOTE: The frame arena only holds CPU data of the slot's previous frame, which was done with
+    // once that frame was recorded, so it can be reused before the fence is waited on.
+    Arena *scratch = &state->frame_arenas[frame];
+    arena_clear(scratch);
+    SceneCullJob cull_job = { 0 };
+    if(!state->gpu_culling) {
+        scene_cull(state, scratch, &cull_job);
+    }
 
     // Draw Frame
-    vkWaitForFences(state->device, 1, &in_flight_fence, VK_TRUE, UINT64_MAX);
+    vulkan_wait_frame(state);
+    state->current_frame = (state->current_frame + 1) % state->frames_in_flight;
+    state->frame_waited  = false;
+    upload_ring_begin_frame(&state->upload_ring, frame);
+    command_recorder_begin_frame(&state->recorder, frame);
 
     unsigned int image_index = 0;
     VkResult result =
         vkAcquireNextImageKHR(state->device, state->swapchain, UINT64_MAX,
                               image_available_semaphore, VK_NULL_HANDLE, &image_index);
     if(result == VK_ERROR_OUT_OF_DATE_KHR) {
-        vulkan_recreate_swapchain(state, arena, window);
+        vulkan_recreate_swapchain(state, scratch, window);
         return;
     } else if((result != VK_SUCCESS) && (result != VK_SUBOPTIMAL_KHR)) {
         printf("Failed to acquire swap chain image!\n");
         exit(1);
     }
-    vkResetFences(state->device, 1, &in_flight_fence);
+    if(!state->timeline) {
+        vkResetFences(state->device, 1, &in_flight_fence);
+    }
 
+    if(!state->gpu_culling) {
+        scene_copy(state, &cull_job, frame);
+    }
+
+    VkSemaphore upload_semaphore = vulkan_submit_uploads(state, frame);
+
+    Uint64 record_start = SDL_GetPerformanceCounter();
     vkResetCommandBuffer(command_buffer, 0);
-    recordCommandBuffer(state, command_buffer, image_index);
+    recordCommandBuffer(state, command_buffer, image_index, frame);
+    state->binds_total += (unsigned long long)atomic_load_i32(&state->draw_queue.binds_count);
+    state->record_ms_total += (double)(SDL_GetPerformanceCounter() - record_start) * 1000.0 /
+                              (double)SDL_GetPerformanceFrequency();
+    ++state->frames_recorded;
+
+    state->frame_numbers[frame] = ++state->frame_number;
+
+    // NOTE: The binary semaphore's signal value is ignored.
+    VkSemaphore signal_semaphores[] = { render_finished_semaphore, state->frame_timeline };
+    uint64_t signal_values[]        = { 0, state->frame_number };
+
+    // NOTE: The uploads of the frame are waited on where their data is consumed, the work before
+    // that overlaps with the transfer.
+    VkSemaphore wait_semaphores[]      = { image_available_semaphore, upload_semaphore };
+    uint64_t wait_values[]             = { 0, state->transfer_value };
+    VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                           UPLOAD_DST_STAGES };
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = { 0 };
+    timeline_info.sType                         = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount       = upload_semaphore != VK_NULL_HANDLE ? 2 : 1;
+    timeline_info.pWaitSemaphoreValues          = wait_values;
+    timeline_info.signalSemaphoreValueCount     = array_len(signal_values);
+    timeline_info.pSignalSemaphoreValues        = signal_values;
 
-    VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
     VkSubmitInfo submit_info           = { 0 };
     submit_info.sType                  = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.waitSemaphoreCount     = 1;
-    submit_info.pWaitSemaphores        = &image_available_semaphore;
+    submit_info.pNext                  = state->timeline ? &timeline_info : NULL;
+    submit_info.waitSemaphoreCount     = upload_semaphore != VK_NULL_HANDLE ? 2 : 1;
+    submit_info.pWaitSemaphores        = wait_semaphores;
     submit_info.pWaitDstStageMask      = wait_stages;
     submit_info.commandBufferCount     = 1;
     submit_info.pCommandBuffers        = &command_buffer;
-    submit_info.signalSemaphoreCount   = 1;
-    submit_info.pSignalSemaphores      = &render_finished_semaphore;
+    submit_info.signalSemaphoreCount   = state->timeline ? 2 : 1;
+    submit_info.pSignalSemaphores      = signal_semaphores;
 
-    if(vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fence) != VK_SUCCESS) {
+    VkFence submit_fence = state->timeline ? VK_NULL_HANDLE : in_flight_fence;
+    if(vkQueueSubmit(graphics_queue, 1, &submit_info, submit_fence) != VK_SUCCESS) {
         printf("Failed to submit draw command buffer!\n");
         exit(1);
     }
+    state->statistics_pending[frame] = state->statistics_pool != VK_NULL_HANDLE;
+    state->timestamps_pending[frame] = state->timestamp_pool != VK_NULL_HANDLE;
+    state->frame_input_times[frame]  = state->input_time;
 
     VkPresentInfoKHR present_info = { 0 };
     present_info.sType            = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -956,11 +2127,17 @@ void vulkan_draw_frame(VkState *state, Arena *arena, SDL_Window *window, VkQueue
     present_info.pResults           = NULL;
 
     result = vkQueuePresentKHR(present_queue, &present_info);
+    if(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+        state->last_present_time = SDL_GetPerformanceCounter();
+        if(state->presents_count++ == 0) {
+            state->first_present_time = state->last_present_time;
+        }
+    }
 
     if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
        state->framebuffer_resized) {
         state->framebuffer_resized = false;
-        vulkan_recreate_swapchain(state, arena, window);
+        vulkan_recreate_swapchain(state, scratch, window);
         return;
     } else if(result != VK_SUCCESS) {
         printf("Failed to present swap chain image!\n");
@@ -968,63 +2145,440 @@ void vulkan_draw_frame(VkState *state, Arena *arena, SDL_Window *window, VkQueue
     }
 }
 
-unsigned int find_memory_type(VkPhysicalDevice physical_device, uint32_t filter,
-                              VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties mem_properties;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
-    for(uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
-        if((filter & (1 << i)) &&
-           (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-
-    printf("Failed to find suitable memory type!\n");
-    exit(1);
-}
-
-void vulkan_create_vertex_buffer(VkState *state) {
+void vulkan_create_buffer(VkState *state, VkDeviceSize size, VkBufferUsageFlags usage,
+                          VkMemoryPropertyFlags properties, VkBuffer *buffer,
+                          GpuAllocation *allocation) {
     VkBufferCreateInfo buffer_info = { 0 };
     buffer_info.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_info.size               = sizeof(vertices);
-    buffer_info.usage              = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    buffer_info.size               = size;
+    buffer_info.usage              = usage;
     buffer_info.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
 
-    if(vkCreateBuffer(state->device, &buffer_info, NULL, &state->vertex_buffer) != VK_SUCCESS) {
-        printf("Failed to create vertex buffer!\n");
+    // NOTE: The transfer queue writes what is uploaded and the graphics queue reads it. Being
+    // concurrent the buffer never changes owner, the semaphores between the queues are enough.
+    unsigned int queue_families[] = { state->graphics_queue_index, state->transfer_queue_index };
+    if(state->use_transfer_queue && (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT)) {
+        buffer_info.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+        buffer_info.queueFamilyIndexCount = array_len(queue_families);
+        buffer_info.pQueueFamilyIndices   = queue_families;
+    }
+
+    if(vkCreateBuffer(state->device, &buffer_info, NULL, buffer) != VK_SUCCESS) {
+        printf("Failed to create buffer!\n");
         exit(1);
     }
 
     VkMemoryRequirements mem_req;
-    vkGetBufferMemoryRequirements(state->device, state->vertex_buffer, &mem_req);
+    vkGetBufferMemoryRequirements(state->device, *buffer, &mem_req);
+
+    *allocation = gpu_alloc(&state->gpu_allocator, &mem_req, properties);
+    vkBindBufferMemory(state->device, *buffer, allocation->memory, allocation->offset);
+}
+
+void vulkan_destroy_buffer(VkState *state, VkBuffer buffer, GpuAllocation *allocation) {
+    vkDestroyBuffer(state->device, buffer, NULL);
+    gpu_free(&state->gpu_allocator, allocation);
+}
+
+// NOTE: read_frame is the last frame that may still read dst, 0 for a buffer no frame used yet.
+void vulkan_upload_buffer(VkState *state, VkBuffer dst, VkDeviceSize dst_offset, const void *data,
+                          VkDeviceSize size, uint64_t read_frame) {
+    // NOTE: Must be called outside of vulkan_draw_frame, waiting for every submitted frame then
+    // frees the whole ring.
+    VkDeviceSize max_chunk = state->upload_ring.size / 2;
+    while(size > 0) {
+        VkDeviceSize chunk = size < max_chunk ? size : max_chunk;
+        if(!upload_ring_push(&state->upload_ring, dst, dst_offset, data, chunk, read_frame)) {
+            vulkan_wait_all_frames(state);
+            upload_ring_release_submitted(&state->upload_ring);
+            if(!upload_ring_push(&state->upload_ring, dst, dst_offset, data, chunk, read_frame)) {
+                printf("Failed to stage buffer upload!\n");
+                exit(1);
+            }
+        }
+        data = (const unsigned char *)data + chunk;
+        dst_offset += chunk;
+        size -= chunk;
+    }
+}
+
+void vulkan_create_mesh(VkState *state, Arena *arena, Mesh *mesh, const Vertex *vertices,
+                        unsigned int vertices_count, const uint32_t *indices,
+                        unsigned int indices_count) {
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->vertices_count = vertices_count;
+    mesh->indices_count  = indices_count;
+    for(unsigned int vertex = 0; vertex < vertices_count; ++vertex) {
+        V2 pos       = vertices[vertex].pos;
+        float radius = sqrtf(pos.x * pos.x + pos.y * pos.y);
+        if(radius > mesh->bounds_radius) {
+            mesh->bounds_radius = radius;
+        }
+    }
+
+    TempMemory temp         = temp_memory_begin(arena);
+    const void *index_data  = indices;
+    VkDeviceSize index_size = sizeof(uint32_t);
+    mesh->index_type        = VK_INDEX_TYPE_UINT32;
+    if(vertices_count <= UINT16_MAX + 1) {
+        uint16_t *indices16 = arena_push_array_no_zero(arena, uint16_t, indices_count);
+        for(unsigned int index = 0; index < indices_count; ++index) {
+            indices16[index] = (uint16_t)indices[index];
+        }
+        index_data       = indices16;
+        index_size       = sizeof(uint16_t);
+        mesh->index_type = VK_INDEX_TYPE_UINT16;
+    }
+
+    VkDeviceSize vertices_size = (VkDeviceSize)vertices_count * sizeof(Vertex);
+    VkDeviceSize indices_size  = (VkDeviceSize)indices_count * index_size;
+    mesh->index_offset         = gpu_align_up(vertices_size, sizeof(uint32_t));
+
+    vulkan_create_buffer(state, mesh->index_offset + indices_size,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->buffer, &mesh->memory);
+
+    vulkan_upload_buffer(state, mesh->buffer, 0, vertices, vertices_size, 0);
+    vulkan_upload_buffer(state, mesh->buffer, mesh->index_offset, index_data, indices_size, 0);
+    temp_memory_end(temp);
+}
+
+void vulkan_destroy_mesh(VkState *state, Mesh *mesh) {
+    vulkan_destroy_buffer(state, mesh->buffer, &mesh->memory);
+}
+
+void vulkan_create_instance_buffers(VkState *state) {
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
+        vulkan_create_buffer(state, state->instances_count * sizeof(Instance),
+                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             &state->instance_buffers[i], &state->instance_buffers_memory[i]);
+    }
+}
+
+void vulkan_destroy_instance_buffers(VkState *state) {
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
+        vulkan_destroy_buffer(state, state->instance_buffers[i],
+                              &state->instance_buffers_memory[i]);
+    }
+}
+
+void vulkan_create_cull_resources(VkState *state) {
+    VkDeviceSize scene_size    = state->instances_count * sizeof(Instance);
+    state->scene_buffers_count = state->stream_scene ? state->frames_in_flight : 1;
+    for(unsigned int i = 0; i < state->scene_buffers_count; ++i) {
+        vulkan_create_buffer(state, scene_size,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &state->scene_buffers[i],
+                             &state->scene_buffers_memory[i]);
+        vulkan_upload_buffer(state, state->scene_buffers[i], 0, state->instances, scene_size, 0);
+    }
+
+    VkDrawIndexedIndirectCommand draw = { 0 };
+    draw.indexCount                   = state->meshes[0].indices_count;
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
+        vulkan_create_buffer(state, scene_size,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &state->visible_buffers[i],
+                             &state->visible_buffers_memory[i]);
+        vulkan_create_buffer(state, sizeof(draw),
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &state->indirect_buffers[i],
+                             &state->indirect_buffers_memory[i]);
+        vulkan_upload_buffer(state, state->indirect_buffers[i], 0, &draw, sizeof(draw), 0);
+    }
+
+    VkDescriptorSetLayoutBinding bindings[3] = { 0 };
+    for(unsigned int binding = 0; binding < array_len(bindings); ++binding) {
+        bindings[binding].binding         = binding;
+        bindings[binding].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding].descriptorCount = 1;
+        bindings[binding].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info = { 0 };
+    layout_info.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = array_len(bindings);
+    layout_info.pBindings    = bindings;
+    if(vkCreateDescriptorSetLayout(state->device, &layout_info, NULL, &state->cull_set_layout) !=
+       VK_SUCCESS) {
+        printf("Failed to create descriptor set layout!\n");
+        exit(1);
+    }
 
-    VkMemoryAllocateInfo alloc_info = { 0 };
-    alloc_info.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize       = mem_req.size;
-    alloc_info.memoryTypeIndex = find_memory_type(state->physical_device, mem_req.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    VkDescriptorPoolSize pool_size = { 0 };
+    pool_size.type                 = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_size.descriptorCount      = array_len(bindings) * state->frames_in_flight;
 
-    if(vkAllocateMemory(state->device, &alloc_info, NULL, &state->vertex_buffer_memory) !=
+    VkDescriptorPoolCreateInfo pool_info = { 0 };
+    pool_info.sType                      = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.maxSets                    = state->frames_in_flight;
+    pool_info.poolSizeCount              = 1;
+    pool_info.pPoolSizes                 = &pool_size;
+    if(vkCreateDescriptorPool(state->device, &pool_info, NULL, &state->cull_descriptor_pool) !=
        VK_SUCCESS) {
-        printf("Failed to allocate vertex buffer memory!\n");
+        printf("Failed to create descriptor pool!\n");
+        exit(1);
+    }
+
+    VkDescriptorSetLayout set_layouts[MAX_FRAMES_IN_FLIGHT];
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
+        set_layouts[i] = state->cull_set_layout;
+    }
+    VkDescriptorSetAllocateInfo alloc_info = { 0 };
+    alloc_info.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool              = state->cull_descriptor_pool;
+    alloc_info.descriptorSetCount          = state->frames_in_flight;
+    alloc_info.pSetLayouts                 = set_layouts;
+    if(vkAllocateDescriptorSets(state->device, &alloc_info, state->cull_sets) != VK_SUCCESS) {
+        printf("Failed to allocate descriptor sets!\n");
+        exit(1);
+    }
+
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
+        VkDescriptorBufferInfo buffer_infos[3] = {
+            { state->scene_buffers[i % state->scene_buffers_count], 0, VK_WHOLE_SIZE },
+            { state->visible_buffers[i], 0, VK_WHOLE_SIZE },
+            { state->indirect_buffers[i], 0, VK_WHOLE_SIZE },
+        };
+        VkWriteDescriptorSet writes[3] = { 0 };
+        for(unsigned int binding = 0; binding < array_len(writes); ++binding) {
+            writes[binding].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[binding].dstSet          = state->cull_sets[i];
+            writes[binding].dstBinding      = binding;
+            writes[binding].descriptorCount = 1;
+            writes[binding].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[binding].pBufferInfo     = &buffer_infos[binding];
+        }
+        vkUpdateDescriptorSets(state->device, array_len(writes), writes, 0, NULL);
+    }
+
+    VkPushConstantRange push_range = { 0 };
+    push_range.stageFlags          = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_range.offset              = 0;
+    push_range.size                = sizeof(CullParams);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = { 0 };
+    pipeline_layout_info.sType                      = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount             = 1;
+    pipeline_layout_info.pSetLayouts                = &state->cull_set_layout;
+    pipeline_layout_info.pushConstantRangeCount     = 1;
+    pipeline_layout_info.pPushConstantRanges        = &push_range;
+    if(vkCreatePipelineLayout(state->device, &pipeline_layout_info, NULL,
+                              &state->cull_pipeline_layout) != VK_SUCCESS) {
+        printf("Failed to create pipeline layout!\n");
         exit(1);
     }
+}
+
+void vulkan_create_cull_pipeline(VkState *state, File *code) {
+    VkShaderModule module = vulkan_create_shader_module(state->device, code);
+
+    VkComputePipelineCreateInfo pipeline_info = { 0 };
+    pipeline_info.sType                       = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage.sType                 = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.stage                 = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module                = module;
+    pipeline_info.stage.pName                 = "main";
+    pipeline_info.layout                      = state->cull_pipeline_layout;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    if(vkCreateComputePipelines(state->device, state->pipeline_cache.cache, 1, &pipeline_info, NULL,
+                                &state->cull_pipeline) != VK_SUCCESS) {
+        printf("Failed to create cull pipeline!\n");
+        exit(1);
+    }
+    pipeline_cache_created(&state->pipeline_cache, start, "cull pipeline");
+
+    vkDestroyShaderModule(state->device, module, NULL);
+}
+
+void vulkan_destroy_cull_resources(VkState *state) {
+    vkDestroyPipeline(state->device, state->cull_pipeline, NULL);
+    vkDestroyPipelineLayout(state->device, state->cull_pipeline_layout, NULL);
+    vkDestroyDescriptorPool(state->device, state->cull_descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(state->device, state->cull_set_layout, NULL);
+    for(unsigned int i = 0; i < state->frames_in_flight; ++i) {
+        vulkan_destroy_buffer(state, state->indirect_buffers[i],
+                              &state->indirect_buffers_memory[i]);
+        vulkan_destroy_buffer(state, state->visible_buffers[i], &state->visible_buffers_memory[i]);
+    }
+    for(unsigned int i = 0; i < state->scene_buffers_count; ++i) {
+        vulkan_destroy_buffer(state, state->scene_buffers[i], &state->scene_buffers_memory[i]);
+    }
+}
+
+// NOTE: A single full size instance, or a grid of small ones with varying colors for the
+// instances benchmark scene. The grid covers SCENE_EXTENT in clip space, so with an extent of 2
+// about three quarters of it is outside the view and can be culled. The materials and depths of
+// the grid are scattered so neighbouring draws rarely share state in submission order and the
+// overlapping instances are drawn in no particular depth order.
+void scene_create_instances(VkState *state, Arena *arena, unsigned int instances_count) {
+    state->instances_count = instances_count;
+    state->instances       = arena_push_array_no_zero(arena, Instance, instances_count);
+    state->materials       = arena_push_array(arena, SceneMaterial, instances_count);
+    if(instances_count == 1) {
+        state->instances[0] = (Instance){ v2(0.0f, 0.0f), 1.0f, v3(1.0f, 1.0f, 1.0f), 0.5f };
+        return;
+    }
 
-    vkBindBufferMemory(state->device, state->vertex_buffer, state->vertex_buffer_memory, 0);
+    unsigned int side = 1;
+    while(side * side < instances_count) {
+        ++side;
+    }
+    float cell = 2.0f * SCENE_EXTENT / (float)side;
+    for(unsigned int i = 0; i < instances_count; ++i) {
+        unsigned int x     = i % side;
+        unsigned int y     = i / side;
+        Instance *instance = &state->instances[i];
+        instance->offset   = v2(-SCENE_EXTENT + cell * ((float)x + 0.5f),
+                                -SCENE_EXTENT + cell * ((float)y + 0.5f));
+        instance->scale    = cell * SCENE_OVERDRAW;
+        instance->color    = v3((float)x / (float)side, (float)y / (float)side, 1.0f);
+
+        uint32_t hash           = (i * 2654435761u) >> 16;
+        instance->depth         = (float)((i * 2246822519u) >> 8) / (float)(1u << 24);
+        SceneMaterial *material = &state->materials[i];
+        material->pipeline      = (uint8_t)(hash % SCENE_PIPELINES_COUNT);
+        material->mesh          = (uint8_t)((hash / SCENE_PIPELINES_COUNT) % SCENE_MESHES_COUNT);
+    }
+}
 
-    void *data;
-    vkMapMemory(state->device, state->vertex_buffer_memory, 0, buffer_info.size, 0, &data);
-    memcpy(data, vertices, buffer_info.size);
-    vkUnmapMemory(state->device, state->vertex_buffer_memory);
+// NOTE: Bounds every mesh an instance can be drawn with, whichever path draws it.
+float scene_mesh_radius(VkState *state) {
+    float radius = 0.0f;
+    for(unsigned int mesh = 0; mesh < SCENE_MESHES_COUNT; ++mesh) {
+        radius = max(radius, state->meshes[mesh].bounds_radius);
+    }
+    return radius;
 }
 
-int main(void) {
+void scene_create_cull_bounds(VkState *state, Arena *arena) {
+    state->cull_path   = cull_best_path();
+    state->cull_bounds = cull_bounds_create(arena, state->instances_count);
+    float mesh_radius  = scene_mesh_radius(state);
+    for(unsigned int i = 0; i < state->instances_count; ++i) {
+        Instance *instance = &state->instances[i];
+        cull_bounds_push(&state->cull_bounds, instance->offset.x, instance->offset.y, 0.0f,
+                         instance->scale * mesh_radius);
+    }
+    if(!state->use_bvh) {
+        printf("cpu culling: %s path\n", cull_path_names[state->cull_path]);
+        return;
+    }
+
+    // NOTE: The boxes bound the same circles the flat path tests, the scene lives at z = 0.
+    Uint64 start     = SDL_GetPerformanceCounter();
+    BvhAabb *objects = arena_push_array_no_zero(arena, BvhAabb, state->instances_count);
+    for(unsigned int i = 0; i < state->instances_count; ++i) {
+        Instance *instance = &state->instances[i];
+        float radius       = instance->scale * mesh_radius;
+        BvhAabb *object    = &objects[i];
+        object->min[0]     = instance->offset.x - radius;
+        object->min[1]     = instance->offset.y - radius;
+        object->min[2]     = 0.0f;
+        object->max[0]     = instance->offset.x + radius;
+        object->max[1]     = instance->offset.y + radius;
+        object->max[2]     = 0.0f;
+    }
+    bvh_build(&state->bvh, arena, objects, state->instances_count);
+    printf("cpu culling: bvh, %u nodes built in %.3f ms\n", state->bvh.nodes_count,
+           (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+               (double)SDL_GetPerformanceFrequency());
+}
+
+// NOTE: Records BENCH_RECORD_DRAWS draws with 1, 2, 4... slices up to the recorder's count, the
+// recorder has one slice per job worker so this is how recording scales with threads. The command
+// buffers are only recorded, never submitted, so the draws don't need valid instances.
+void vulkan_bench_record(VkState *state) {
+    vkDeviceWaitIdle(state->device);
+    Arena *scratch = &state->frame_arenas[0];
+    arena_clear(scratch);
+    draw_queue_begin(&state->draw_queue, scratch, BENCH_RECORD_DRAWS);
+    for(unsigned int draw = 0; draw < BENCH_RECORD_DRAWS; ++draw) {
+        scene_queue_draw(state, draw, draw % state->instances_count);
+    }
+    if(state->sort_draws) {
+        draw_queue_sort(&state->draw_queue);
+    }
+
+    CommandRecorder *recorder = &state->recorder;
+    double single_ms          = 0.0;
+    for(unsigned int threads = 1;; threads = min(threads * 2, recorder->slices_capacity)) {
+        recorder->max_slices = threads;
+        Uint64 start         = SDL_GetPerformanceCounter();
+        unsigned int slices  = 0;
+        for(unsigned int i = 0; i < BENCH_RECORD_ITERATIONS; ++i) {
+            command_recorder_begin_frame(recorder, 0);
+            slices = command_recorder_record(recorder, VK_NULL_HANDLE, state->render_pass,
+                                             VK_NULL_HANDLE, 0, BENCH_RECORD_DRAWS,
+                                             vulkan_record_scene_slice, state);
+        }
+        double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+                    (double)SDL_GetPerformanceFrequency() / BENCH_RECORD_ITERATIONS;
+        if(threads == 1) {
+            single_ms = ms;
+        }
+        printf("record bench: %u draws, %2u threads (%2u slices), %8.3f ms, %5.2fx\n",
+               BENCH_RECORD_DRAWS, threads, slices, ms, single_ms / ms);
+        if(threads == recorder->slices_capacity) {
+            break;
+        }
+    }
+    recorder->max_slices = recorder->slices_capacity;
+    command_recorder_begin_frame(recorder, 0);
+}
+
+int main(int argc, char **argv) {
+    Config config = config_parse(argc, argv);
 
     // Application Setup
-    Arena arena = arena_create(mb(100));
+    Arena arena           = arena_create_virtual(PERSISTENT_ARENA_SIZE, 0);
+    VkState state         = { 0 };
+    state.swapchain_arena = arena_create_virtual(SWAPCHAIN_ARENA_SIZE, 0);
+    vulkan_create_frames(&state, &arena, config.frames_in_flight);
+    state.wait_early         = config.wait_early;
+    state.latency_mode       = config.latency_mode;
+    state.timeline           = !config.no_timeline;
+    state.use_transfer_queue = !config.no_transfer_queue;
+
     SDL_Init(SDL_INIT_VIDEO);
 
+    // NOTE: One pool of workers for every parallel system, the main thread is worker 0.
+    state.jobs = arena_push_struct(&arena, JobSystem);
+    job_system_init(state.jobs, config.job_threads);
+
+    // NOTE: Start loading the shaders right away so the I/O overlaps the vulkan setup, the pipeline
+    // is created once both of them come out of the completion queue.
+    AssetLoader *asset_loader = arena_push_struct(&arena, AssetLoader);
+    asset_loader_init(asset_loader, ASSET_LOADER_WORKERS);
+
+    // NOTE: build.bat writes res.pack next to the executable, without it the loose files in ./res
+    // are used.
+    Pack pack = { 0 };
+    if(pack_open(&pack, ASSET_PACK_PATH)) {
+        printf("Using asset pack: %s (%u files)\n", ASSET_PACK_PATH, pack.header->entries_count);
+        asset_loader_mount_pack(asset_loader, &pack);
+    }
+    AssetRequest *vert_shader = asset_load(asset_loader, "./res/shaders/vert.spv",
+                                           ASSET_PRIORITY_VISIBLE, NULL, NULL);
+    AssetRequest *frag_shader = asset_load(asset_loader, "./res/shaders/frag.spv",
+                                           ASSET_PRIORITY_VISIBLE, NULL, NULL);
+    AssetRequest *depth_shader = NULL;
+    if(config.depth_prepass) {
+        depth_shader = asset_load(asset_loader, "./res/shaders/depth.spv", ASSET_PRIORITY_VISIBLE,
+                                  NULL, NULL);
+    }
+    AssetRequest *cull_shader = NULL;
+    if(config.gpu_culling) {
+        cull_shader = asset_load(asset_loader, "./res/shaders/cull.spv", ASSET_PRIORITY_VISIBLE,
+                                 NULL, NULL);
+    }
+
     // Create SDL2 Window
     int w        = 1920 / 2;
     int h        = 1080 / 2;
@@ -1033,37 +2587,77 @@ int main(void) {
     SDL_Window *window = SDL_CreateWindow(
         "vulkan (hello, triangle!)", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, w, h,
         SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-    VkState state = { 0 };
 
     vulkan_create_instance(&state, &arena, window);
     vulkan_create_surface(&state, window);
     vulkan_select_physical_device(&state, &arena);
+    vulkan_select_depth_format(&state);
     vulkan_find_family_queues(&state, &arena);
     vulkan_create_logical_device(&state, &arena);
-    vulkan_create_swapchain(&state, &arena, window);
-    vulkan_create_images_views(&state, &arena);
-    vulkan_create_render_pass(&state);
-    vulkan_create_graphics_pipeline(&state, &arena);
-    vulkan_create_framebuffer(&state, &arena);
+    gpu_allocator_init(&state.gpu_allocator, state.physical_device, state.device);
+    deletion_queue_create(&state.deletion_queue, &arena, state.device, &state.gpu_allocator);
+    pipeline_cache_create(&state.pipeline_cache, &arena, state.physical_device, state.device,
+                          PIPELINE_CACHE_PATH);
+    vulkan_create_swapchain(&state, &arena, window, VK_NULL_HANDLE);
+    vulkan_create_images_views(&state, &state.swapchain_arena);
 
     vulkan_create_command_pool(&state);
     vulkan_create_command_buffer(&state);
     vulkan_create_sync_objs(&state);
+    state.parallel_record =
+        config.no_instancing && !config.gpu_culling && state.jobs->workers_count > 1;
+    command_recorder_init(&state.recorder, state.jobs, state.device, state.graphics_queue_index,
+                          state.parallel_record ? state.jobs->workers_count : 1,
+                          state.frames_in_flight);
+    vulkan_create_statistics_pool(&state);
+    vulkan_create_timestamp_pool(&state);
+    vulkan_create_transfer_engine(&state);
+
+    upload_ring_create(&state.upload_ring, state.device, &state.gpu_allocator, UPLOAD_RING_SIZE);
+    vulkan_create_mesh(&state, &arena, &state.meshes[0], vertices, array_len(vertices), indices,
+                       array_len(indices));
+    vulkan_create_mesh(&state, &arena, &state.meshes[1], quad_vertices, array_len(quad_vertices),
+                       quad_indices, array_len(quad_indices));
+    scene_create_instances(&state, &arena, config.instances_count);
+    state.use_bvh = config.use_bvh;
+    scene_create_cull_bounds(&state, &arena);
+    state.no_instancing = config.no_instancing;
+    state.sort_draws    = !config.no_draw_sort;
+    state.gpu_culling   = config.gpu_culling;
+    state.stream_scene  = config.upload_stress;
+    if(state.gpu_culling) {
+        vulkan_create_cull_resources(&state);
+    } else {
+        vulkan_create_instance_buffers(&state);
+    }
+    state.post          = config.post;
+    state.depth_prepass = config.depth_prepass;
+    vulkan_create_render_graph(&state);
 
-    vulkan_create_vertex_buffer(&state);
-
-    printf("frambuffer count: %d\n", state.framebuffers_count);
-    printf("Total allocated size: %zu\n", arena.used);
+    render_graph_print_stats(state.render_graph);
+    arena_print_stats("persistent", &arena);
+    arena_print_stats("swapchain", &state.swapchain_arena);
+    gpu_allocator_print_stats(&state.gpu_allocator);
 
     // Retrive Graphics queue
     VkQueue present_queue, graphics_queue;
     vkGetDeviceQueue(state.device, state.present_queue_index, 0, &present_queue);
     vkGetDeviceQueue(state.device, state.graphics_queue_index, 0, &graphics_queue);
 
-    while(running) {
+    // NOTE: Paces the start of every frame, before the input is polled so the wait doesn't add
+    // to the input latency.
+    FramePacer pacer = { 0 };
+    frame_pacer_init(&pacer, config.target_fps);
 
-        arena_clear(&arena);
+    while(running) {
 
+        frame_pacer_wait(&pacer);
+        // NOTE: In low latency mode the wait for the GPU happens here, so the events polled next
+        // are as new as possible when the frame is recorded.
+        if(state.wait_early) {
+            vulkan_wait_frame(&state);
+        }
+        state.input_time = SDL_GetPerformanceCounter();
         SDL_Event e;
         while(SDL_PollEvent(&e)) {
             switch(e.type) {
@@ -1081,10 +2675,155 @@ int main(void) {
             }
         }
 
-        vulkan_draw_frame(&state, &arena, window, present_queue, graphics_queue);
+        AssetRequest *request = NULL;
+        while((request = asset_loader_poll(asset_loader)) != NULL) {
+            if(request->failed) {
+                printf("Failed to load asset: %s\n", request->path);
+                exit(1);
+            }
+        }
+
+        if(state.pipelines[0] == VK_NULL_HANDLE && vert_shader->done && frag_shader->done &&
+           (depth_shader == NULL || depth_shader->done)) {
+            vulkan_create_graphics_pipeline(&state, &vert_shader->data, &frag_shader->data,
+                                            depth_shader ? &depth_shader->data : NULL);
+            pipeline_cache_save(&state.pipeline_cache, &arena, state.device);
+            asset_release(asset_loader, vert_shader);
+            asset_release(asset_loader, frag_shader);
+            if(depth_shader) {
+                asset_release(asset_loader, depth_shader);
+            }
+            asset_loader_print_stats(asset_loader);
+            if(config.bench_record) {
+                vulkan_bench_record(&state);
+                running = false;
+            }
+        }
+        if(cull_shader && state.cull_pipeline == VK_NULL_HANDLE && cull_shader->done) {
+            vulkan_create_cull_pipeline(&state, &cull_shader->data);
+            pipeline_cache_save(&state.pipeline_cache, &arena, state.device);
+            asset_release(asset_loader, cull_shader);
+        }
+
+        // NOTE: The scene buffer of the slot the next frame uses was last read by the slot's
+        // previous frame.
+        if(state.stream_scene) {
+            unsigned int frame = state.current_frame;
+            vulkan_upload_buffer(&state, state.scene_buffers[frame], 0, state.instances,
+                                 state.instances_count * sizeof(Instance),
+                                 state.frame_numbers[frame]);
+        }
+
+        vulkan_draw_frame(&state, window, present_queue, graphics_queue);
     }
 
     vkDeviceWaitIdle(state.device);
+    pipeline_cache_save(&state.pipeline_cache, &arena, state.device);
+
+    arena_print_stats("persistent", &arena);
+    arena_print_stats("swapchain", &state.swapchain_arena);
+    for(unsigned int i = 0; i < state.frames_in_flight; ++i) {
+        arena_print_stats("frame", &state.frame_arenas[i]);
+    }
+    gpu_allocator_print_stats(&state.gpu_allocator);
+    upload_ring_print_stats(&state.upload_ring);
+    asset_loader_print_stats(asset_loader);
+    frame_pacer_print_stats(&pacer);
+    if(state.frames_recorded > 0) {
+        printf("record: %u instances, %u visible, %u draws/frame, %.3f ms/frame avg, "
+               "%u threads\n",
+               state.instances_count, state.visible_count, state.draws_count,
+               state.record_ms_total / (double)state.frames_recorded,
+               state.parallel_record ? state.record_slices : 1);
+    }
+    if(state.frames_recorded > 0 && state.no_instancing && !state.gpu_culling) {
+        double frames = (double)state.frames_recorded;
+        printf("draw queue: %s, %.1f binds/frame in submission order, %.1f binds/frame issued, "
+               "%.3f ms/frame sorting (%u/%u radix passes)\n",
+               state.sort_draws ? "sorted" : "unsorted", state.binds_unsorted_total / frames,
+               state.binds_total / frames, state.sort_ms_total / frames, state.sort_passes,
+               DRAW_RADIX_PASSES);
+    }
+    if(state.frames_queried > 0) {
+        double invocations = (double)state.fragment_invocations_total / state.frames_queried;
+        double pixels      = (double)state.swapchain_extent.width * state.swapchain_extent.height;
+        printf("depth: %s, %.0f fragment invocations/frame, %.2f per pixel\n",
+               state.depth_prepass ? "prepass" : "no prepass", invocations, invocations / pixels);
+    }
+    if(state.presents_count > 1 && state.latency_samples > 0) {
+        double seconds = (double)(state.last_present_time - state.first_present_time) /
+                         (double)SDL_GetPerformanceFrequency();
+        printf("latency: %s mode, %u frames in flight%s, %.1f fps, input to present %.2f ms avg, "
+               "%.2f ms max, %.3f ms/frame %s wait\n",
+               state.latency_mode, state.frames_in_flight, state.wait_early ? " (wait early)" : "",
+               (double)(state.presents_count - 1) / seconds,
+               state.latency_ms_total / (double)state.latency_samples, state.latency_ms_max,
+               state.fence_wait_ms_total / (double)state.presents_count,
+               state.timeline ? "timeline" : "fence");
+    }
+    if(state.frames_timed > 0 && state.presents_count > 1) {
+        double seconds = (double)(state.last_present_time - state.first_present_time) /
+                         (double)SDL_GetPerformanceFrequency();
+        double frames  = (double)state.frames_timed;
+        printf("transfer: uploads on the %s queue, %.1f MB/s uploaded, %.3f ms/frame graphics GPU "
+               "time",
+               state.use_transfer_queue ? "transfer" : "graphics",
+               upload_ring_get_stats(&state.upload_ring).total_mb / seconds,
+               state.gpu_frame_ms_total / frames);
+        // NOTE: The graphics timestamps don't see the copies of the transfer queue.
+        if(!state.use_transfer_queue) {
+            printf(", %.3f ms/frame of it copying", state.gpu_upload_ms_total / frames);
+        }
+        printf("\n");
+    }
+    if(state.swapchains_recreated > 0) {
+        printf("swapchain: %u recreations\n", state.swapchains_recreated);
+    }
+    asset_loader_shutdown(asset_loader);
+    command_recorder_shutdown(&state.recorder);
+    job_system_shutdown(state.jobs);
+    job_system_print_stats(state.jobs);
+    pack_close(&pack);
+    if(state.gpu_culling) {
+        vulkan_destroy_cull_resources(&state);
+    } else {
+        vulkan_destroy_instance_buffers(&state);
+    }
+    if(state.statistics_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(state.device, state.statistics_pool, NULL);
+    }
+    if(state.timestamp_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(state.device, state.timestamp_pool, NULL);
+    }
+    if(state.transfer_command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(state.device, state.transfer_command_pool, NULL);
+    }
+    for(unsigned int mesh = 0; mesh < SCENE_MESHES_COUNT; ++mesh) {
+        vulkan_destroy_mesh(&state, &state.meshes[mesh]);
+    }
+    upload_ring_destroy(&state.upload_ring, state.device, &state.gpu_allocator);
+    pipeline_cache_destroy(&state.pipeline_cache, state.device);
+    for(unsigned int i = 0; i < SCENE_PIPELINES_COUNT; ++i) {
+        vulkan_release(&state,
+                       (Deletion){ .type = DELETION_PIPELINE, .pipeline = state.pipelines[i] });
+    }
+    vulkan_release(&state,
+                   (Deletion){ .type = DELETION_PIPELINE, .pipeline = state.depth_pipeline });
+    vulkan_release(&state, (Deletion){ .type            = DELETION_PIPELINE_LAYOUT,
+                                       .pipeline_layout = state.pipeline_layout });
+    deletion_queue_collect(&state.deletion_queue, UINT64_MAX);
+    deletion_queue_print_stats(&state.deletion_queue);
+    vulkan_cleanup_swapchain(&state);
+    gpu_allocator_destroy(&state.gpu_allocator);
+
+    for(unsigned int i = 0; i < state.frames_in_flight; ++i) {
+        arena_destroy(&state.frame_arenas[i]);
+    }
+    arena_destroy(&state.swapchain_arena);
+    for(unsigned int i = 0; i < state.spare_swapchain_arenas_count; ++i) {
+        arena_destroy(&state.spare_swapchain_arenas[i]);
+    }
+    arena_destroy(&arena);
 
     return 0;
 }
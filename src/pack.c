@@ -0,0 +1,157 @@
+// NOTE: Single file asset pack. The layout is a header, an open addressing hash index, the names
+// blob and then the asset blobs, each one aligned to PACK_BLOB_ALIGN and sorted by name so assets
+// in the same directory are contiguous on disk. The runtime maps the whole pack once and resolves
+// names in O(1) without touching the file system, the returned File points straight into the map.
+// Names are stored relative to the working directory with forward slashes, e.g.
+// "res/shaders/vert.spv".
+
+#define PACK_MAGIC 0x4b434150 // NOTE: "PACK"
+#define PACK_VERSION 1
+#define PACK_BLOB_ALIGN 64
+
+typedef struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entries_count;
+    uint32_t index_capacity; // NOTE: Power of two, at least twice entries_count.
+    uint64_t index_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t data_offset;
+} PackHeader;
+
+// NOTE: A hash of 0 marks an empty index slot.
+typedef struct PackEntry {
+    uint64_t hash;
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint64_t offset;
+    uint64_t size;
+} PackEntry;
+
+typedef struct Pack {
+    FileMapping mapping;
+    PackHeader *header;
+    PackEntry *index;
+    char *names;
+} Pack;
+
+// NOTE: Skips a leading "./" and treats '\\' as '/' so "./res\\a.spv" and "res/a.spv" match.
+static const char *pack_normalize_name(const char *name) {
+    while(name[0] == '.' && (name[1] == '/' || name[1] == '\\')) {
+        name += 2;
+    }
+    return name;
+}
+
+static inline char pack_name_char(char c) {
+    return c == '\\' ? '/' : c;
+}
+
+// NOTE: FNV-1a 64 over the normalized name.
+uint64_t pack_hash(const char *name) {
+    name          = pack_normalize_name(name);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(; *name; ++name) {
+        hash ^= (unsigned char)pack_name_char(*name);
+        hash *= 0x100000001b3ull;
+    }
+    return hash ? hash : 1;
+}
+
+static bool pack_name_equals(const char *stored, uint32_t stored_size, const char *name) {
+    name = pack_normalize_name(name);
+    for(uint32_t i = 0; i < stored_size; ++i) {
+        if(name[i] == '\0' || pack_name_char(name[i]) != stored[i]) {
+            return false;
+        }
+    }
+    return name[stored_size] == '\0';
+}
+
+// NOTE: offset + size <= limit without overflowing.
+static inline bool pack_range_valid(uint64_t offset, uint64_t size, uint64_t limit) {
+    return offset <= limit && size <= limit - offset;
+}
+
+// NOTE: Every used slot has to point inside the names and the file, and the used slots have to
+// match entries_count so the index keeps an empty slot to end the probes of missing names.
+static bool pack_index_valid(Pack *pack, size_t file_size) {
+    PackHeader *header  = pack->header;
+    uint32_t used_count = 0;
+    for(uint32_t slot = 0; slot < header->index_capacity; ++slot) {
+        PackEntry *entry = &pack->index[slot];
+        if(entry->hash == 0) {
+            continue;
+        }
+        if(!pack_range_valid(entry->name_offset, entry->name_size, header->names_size) ||
+           !pack_range_valid(entry->offset, entry->size, file_size)) {
+            return false;
+        }
+        ++used_count;
+    }
+    return used_count == header->entries_count;
+}
+
+bool pack_open(Pack *pack, const char *path) {
+    memset(pack, 0, sizeof(*pack));
+    pack->mapping = file_map(path);
+    if(pack->mapping.data == NULL) {
+        return false;
+    }
+
+    size_t size        = pack->mapping.size;
+    PackHeader *header = (PackHeader *)pack->mapping.data;
+    if(size < sizeof(PackHeader) || header->magic != PACK_MAGIC ||
+       header->version != PACK_VERSION || header->index_capacity == 0 ||
+       !is_power_of_two(header->index_capacity) ||
+       header->entries_count >= header->index_capacity ||
+       !pack_range_valid(header->index_offset,
+                         (uint64_t)header->index_capacity * sizeof(PackEntry), size) ||
+       !pack_range_valid(header->names_offset, header->names_size, size) ||
+       header->data_offset > size) {
+        printf("Invalid asset pack: %s\n", path);
+        file_unmap(&pack->mapping);
+        return false;
+    }
+
+    pack->header = header;
+    pack->index  = (PackEntry *)((unsigned char *)pack->mapping.data + header->index_offset);
+    pack->names  = (char *)pack->mapping.data + header->names_offset;
+    if(!pack_index_valid(pack, size)) {
+        printf("Invalid asset pack index: %s\n", path);
+        file_unmap(&pack->mapping);
+        memset(pack, 0, sizeof(*pack));
+        return false;
+    }
+    return true;
+}
+
+void pack_close(Pack *pack) {
+    file_unmap(&pack->mapping);
+    memset(pack, 0, sizeof(*pack));
+}
+
+bool pack_find(Pack *pack, const char *name, File *result) {
+    if(pack->header == NULL) {
+        return false;
+    }
+
+    // NOTE: pack_open made sure there is an empty slot, the bound only guards the loop.
+    uint64_t hash = pack_hash(name);
+    uint32_t mask = pack->header->index_capacity - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+    for(uint32_t probe = 0; probe < pack->header->index_capacity; ++probe) {
+        PackEntry *entry = &pack->index[slot];
+        if(entry->hash == 0) {
+            return false;
+        }
+        if(entry->hash == hash &&
+           pack_name_equals(pack->names + entry->name_offset, entry->name_size, name)) {
+            *result = file_view(&pack->mapping, (size_t)entry->offset, (size_t)entry->size);
+            return true;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return false;
+}
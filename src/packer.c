@@ -0,0 +1,214 @@
+// NOTE: Builds an asset pack from a directory, e.g. "vulkan_packer res build\res.pack". Every file
+// under the directory is stored with its path relative to the working directory, so the runtime
+// can resolve the same names it would pass to file_map.
+
+#include "common.h"
+
+#include "arena.c"
+#include "file.c"
+#include "pack.c"
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#endif
+
+#define PACKER_MAX_ENTRIES 65536
+#define PACKER_PATH_SIZE 512
+
+typedef struct PackerEntry {
+    char *name;
+    uint32_t name_size;
+    uint32_t name_offset;
+    uint64_t offset;
+    uint64_t size;
+} PackerEntry;
+
+typedef struct Packer {
+    Arena *arena;
+    PackerEntry *entries;
+    uint32_t entries_count;
+} Packer;
+
+static void packer_add_file(Packer *packer, const char *path) {
+    if(packer->entries_count == PACKER_MAX_ENTRIES) {
+        printf("Too many files to pack!\n");
+        exit(1);
+    }
+    size_t size        = strlen(path);
+    PackerEntry *entry = &packer->entries[packer->entries_count++];
+    entry->name        = arena_push_array_no_zero(packer->arena, char, size + 1);
+    for(size_t i = 0; i <= size; ++i) {
+        entry->name[i] = pack_name_char(path[i]);
+    }
+    entry->name_size = (uint32_t)size;
+}
+
+static void packer_add_directory(Packer *packer, const char *directory) {
+    char path[PACKER_PATH_SIZE];
+#if defined(_WIN32)
+    snprintf(path, sizeof(path), "%s\\*", directory);
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA(path, &find_data);
+    if(find == INVALID_HANDLE_VALUE) {
+        printf("Failed to open directory: %s\n", directory);
+        exit(1);
+    }
+    do {
+        const char *name = find_data.cFileName;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", directory, name);
+        if(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            packer_add_directory(packer, path);
+        } else {
+            packer_add_file(packer, path);
+        }
+    } while(FindNextFileA(find, &find_data));
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory);
+    if(dir == NULL) {
+        printf("Failed to open directory: %s\n", directory);
+        exit(1);
+    }
+    struct dirent *dir_entry;
+    while((dir_entry = readdir(dir)) != NULL) {
+        const char *name = dir_entry->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", directory, name);
+        struct stat file_stat;
+        if(stat(path, &file_stat) != 0) {
+            continue;
+        }
+        if(S_ISDIR(file_stat.st_mode)) {
+            packer_add_directory(packer, path);
+        } else if(S_ISREG(file_stat.st_mode)) {
+            packer_add_file(packer, path);
+        }
+    }
+    closedir(dir);
+#endif
+}
+
+static int packer_compare_entries(const void *a, const void *b) {
+    return strcmp(((const PackerEntry *)a)->name, ((const PackerEntry *)b)->name);
+}
+
+static void packer_write_zeros(FILE *file, uint64_t count) {
+    static const unsigned char zeros[4096] = { 0 };
+    while(count > 0) {
+        size_t size = count < sizeof(zeros) ? (size_t)count : sizeof(zeros);
+        fwrite(zeros, 1, size, file);
+        count -= size;
+    }
+}
+
+static inline uint64_t packer_align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+int main(int argc, char **argv) {
+    if(argc != 3) {
+        printf("usage: %s <directory> <output.pack>\n", argv[0]);
+        return 1;
+    }
+    const char *directory = pack_normalize_name(argv[1]);
+    const char *out_path  = argv[2];
+
+    Arena arena    = arena_create_virtual(gb(4), 0);
+    Packer packer  = { 0 };
+    packer.arena   = &arena;
+    packer.entries = arena_push_array(&arena, PackerEntry, PACKER_MAX_ENTRIES);
+
+    // NOTE: Strip trailing separators so names come out as "res/a.spv" and not "res//a.spv".
+    size_t directory_size = strlen(directory);
+    char *root            = arena_push_array_no_zero(&arena, char, directory_size + 1);
+    memcpy(root, directory, directory_size + 1);
+    while(directory_size > 1 &&
+          (root[directory_size - 1] == '/' || root[directory_size - 1] == '\\')) {
+        root[--directory_size] = '\0';
+    }
+    packer_add_directory(&packer, root);
+
+    // NOTE: Sorting by name keeps the files of a directory next to each other in the pack.
+    qsort(packer.entries, packer.entries_count, sizeof(PackerEntry), packer_compare_entries);
+
+    uint32_t index_capacity = 16;
+    while(index_capacity < packer.entries_count * 2) {
+        index_capacity *= 2;
+    }
+
+    PackHeader header     = { 0 };
+    header.magic          = PACK_MAGIC;
+    header.version        = PACK_VERSION;
+    header.entries_count  = packer.entries_count;
+    header.index_capacity = index_capacity;
+    header.index_offset   = sizeof(PackHeader);
+    header.names_offset   = header.index_offset + (uint64_t)index_capacity * sizeof(PackEntry);
+    for(uint32_t entry_index = 0; entry_index < packer.entries_count; ++entry_index) {
+        PackerEntry *entry = &packer.entries[entry_index];
+        entry->name_offset = (uint32_t)header.names_size;
+        header.names_size += entry->name_size;
+    }
+    header.data_offset = packer_align_up(header.names_offset + header.names_size, PACK_BLOB_ALIGN);
+
+    FILE *file = fopen(out_path, "wb");
+    if(file == NULL) {
+        printf("Failed to open file: %s\n", out_path);
+        return 1;
+    }
+
+    // NOTE: Blobs go first so their offsets and sizes are known, the header, index and names are
+    // written over the zeroed space at the start of the file afterwards.
+    packer_write_zeros(file, header.data_offset);
+    uint64_t offset = header.data_offset;
+    for(uint32_t entry_index = 0; entry_index < packer.entries_count; ++entry_index) {
+        PackerEntry *entry = &packer.entries[entry_index];
+        TempMemory temp    = temp_memory_begin(&arena);
+        File data          = read_entire_file(&arena, entry->name);
+        if(data.data == NULL) {
+            return 1;
+        }
+        uint64_t aligned = packer_align_up(offset, PACK_BLOB_ALIGN);
+        packer_write_zeros(file, aligned - offset);
+        offset        = aligned;
+        entry->offset = offset;
+        entry->size   = data.size;
+        fwrite(data.data, 1, data.size, file);
+        offset += data.size;
+        temp_memory_end(temp);
+    }
+
+    PackEntry *index = arena_push_array(&arena, PackEntry, index_capacity);
+    for(uint32_t entry_index = 0; entry_index < packer.entries_count; ++entry_index) {
+        PackerEntry *entry = &packer.entries[entry_index];
+        uint64_t hash      = pack_hash(entry->name);
+        uint32_t slot      = (uint32_t)hash & (index_capacity - 1);
+        while(index[slot].hash != 0) {
+            slot = (slot + 1) & (index_capacity - 1);
+        }
+        index[slot].hash        = hash;
+        index[slot].name_offset = entry->name_offset;
+        index[slot].name_size   = entry->name_size;
+        index[slot].offset      = entry->offset;
+        index[slot].size        = entry->size;
+    }
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(index, sizeof(PackEntry), index_capacity, file);
+    for(uint32_t entry_index = 0; entry_index < packer.entries_count; ++entry_index) {
+        PackerEntry *entry = &packer.entries[entry_index];
+        fwrite(entry->name, 1, entry->name_size, file);
+    }
+    fclose(file);
+
+    printf("Packed %u files (%.3f MB) into %s\n", packer.entries_count,
+           (double)offset / (double)mb(1), out_path);
+
+    arena_destroy(&arena);
+    return 0;
+}
@@ -0,0 +1,151 @@
+// NOTE: VkPipelineCache persisted between runs. The blob on disk is only handed to the driver when
+// its header matches the current device (vendor id, device id and cache uuid), otherwise an empty
+// cache is created and the file is replaced on the next save. Saves go to a temporary file that is
+// renamed over the old one, so a crash in the middle of a save never leaves a truncated cache.
+
+#define PIPELINE_CACHE_HEADER_SIZE (4 * sizeof(uint32_t) + VK_UUID_SIZE)
+
+typedef struct PipelineCache {
+    VkPipelineCache cache;
+    const char *path;
+
+    // NOTE: True when the cache was seeded from disk, pipelines created with it should hit.
+    // saved_size is the size of the blob on disk, a warm cache that grew past it had misses.
+    bool warm;
+    bool dirty;
+    size_t saved_size;
+} PipelineCache;
+
+static double pipeline_cache_ms(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+           (double)SDL_GetPerformanceFrequency();
+}
+
+static bool pipeline_cache_validate(VkPhysicalDevice physical_device, File *data) {
+    if(data->size < PIPELINE_CACHE_HEADER_SIZE) {
+        printf("Pipeline cache: file too small, ignoring it\n");
+        return false;
+    }
+
+    uint32_t header[4];
+    memcpy(header, data->data, sizeof(header));
+    const unsigned char *uuid = (unsigned char *)data->data + sizeof(header);
+
+    VkPhysicalDeviceProperties device_props;
+    vkGetPhysicalDeviceProperties(physical_device, &device_props);
+
+    if(header[0] < PIPELINE_CACHE_HEADER_SIZE || header[0] > data->size ||
+       header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+        printf("Pipeline cache: unknown header, ignoring it\n");
+        return false;
+    }
+    if(header[2] != device_props.vendorID || header[3] != device_props.deviceID ||
+       memcmp(uuid, device_props.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        printf("Pipeline cache: created by a different device or driver, ignoring it\n");
+        return false;
+    }
+    return true;
+}
+
+void pipeline_cache_create(PipelineCache *cache, Arena *arena, VkPhysicalDevice physical_device,
+                           VkDevice device, const char *path) {
+    memset(cache, 0, sizeof(*cache));
+    cache->path = path;
+
+    TempMemory temp = temp_memory_begin(arena);
+    Uint64 start    = SDL_GetPerformanceCounter();
+
+    File data = read_entire_file(arena, path);
+    if(data.data != NULL && !pipeline_cache_validate(physical_device, &data)) {
+        data.data = NULL;
+        data.size = 0;
+    }
+
+    VkPipelineCacheCreateInfo cache_info = { 0 };
+    cache_info.sType                     = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.initialDataSize           = data.size;
+    cache_info.pInitialData              = data.data;
+
+    VkResult result = vkCreatePipelineCache(device, &cache_info, NULL, &cache->cache);
+    if(result != VK_SUCCESS && data.data != NULL) {
+        // NOTE: The driver can still reject a blob that passed the header check, start cold.
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData    = NULL;
+        data.data                  = NULL;
+        data.size                  = 0;
+        result = vkCreatePipelineCache(device, &cache_info, NULL, &cache->cache);
+    }
+    if(result != VK_SUCCESS) {
+        printf("Failed to create pipeline cache!\n");
+        exit(1);
+    }
+
+    cache->warm       = data.data != NULL;
+    cache->dirty      = !cache->warm;
+    cache->saved_size = data.size;
+    printf("Pipeline cache: %s, %zu bytes loaded in %.3f ms\n", cache->warm ? "warm" : "cold",
+           data.size, pipeline_cache_ms(start));
+
+    temp_memory_end(temp);
+}
+
+// NOTE: Call right after creating a pipeline with the counter value taken before it, logs the
+// creation time so warm (hit) and cold (miss) starts can be compared. Only a cold cache is known
+// to have changed, a warm one is saved when its data size differs from the file.
+void pipeline_cache_created(PipelineCache *cache, Uint64 start, const char *name) {
+    double ms = pipeline_cache_ms(start);
+    if(!cache->warm) {
+        cache->dirty = true;
+    }
+    printf("Pipeline cache: %s created in %.3f ms (%s)\n", name, ms,
+           cache->warm ? "warm cache" : "cold cache");
+}
+
+void pipeline_cache_save(PipelineCache *cache, Arena *arena, VkDevice device) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    size_t size  = 0;
+    vkGetPipelineCacheData(device, cache->cache, &size, NULL);
+    if(!cache->dirty && size == cache->saved_size) {
+        return;
+    }
+
+    TempMemory temp = temp_memory_begin(arena);
+    void *data = arena_push_no_zero(arena, size, 16);
+    if(vkGetPipelineCacheData(device, cache->cache, &size, data) != VK_SUCCESS) {
+        printf("Pipeline cache: failed to get cache data\n");
+        temp_memory_end(temp);
+        return;
+    }
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    FILE *file = fopen(tmp_path, "wb");
+    if(file == NULL) {
+        printf("Failed to open file: %s\n", tmp_path);
+        temp_memory_end(temp);
+        return;
+    }
+    bool written = fwrite(data, 1, size, file) == size;
+    written      = fclose(file) == 0 && written;
+
+#if defined(_WIN32)
+    bool renamed = written && MoveFileExA(tmp_path, cache->path,
+                                          MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    bool renamed = written && rename(tmp_path, cache->path) == 0;
+#endif
+    if(!renamed) {
+        printf("Pipeline cache: failed to save %s\n", cache->path);
+        remove(tmp_path);
+    } else {
+        cache->dirty      = false;
+        cache->saved_size = size;
+        printf("Pipeline cache: %zu bytes saved in %.3f ms\n", size, pipeline_cache_ms(start));
+    }
+
+    temp_memory_end(temp);
+}
+
+void pipeline_cache_destroy(PipelineCache *cache, VkDevice device) {
+    vkDestroyPipelineCache(device, cache->cache, NULL);
+}
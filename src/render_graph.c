@@ -0,0 +1,880 @@
+// NOTE: Frame graph. Passes are declared in execution order together with the resources they read
+// and write, then render_graph_compile works out everything that used to be written by hand:
+//
+//   - Passes whose results never reach an output (an imported image with a final layout, e.g. the
+//     swapchain) are culled.
+//   - Every use gets the pipeline barrier and layout transition it needs, and only that: reads of
+//     an already visible write, or reads after reads, don't get one. The barriers of a pass are
+//     batched in a single vkCmdPipelineBarrier.
+//   - Transient images get memory from the GpuAllocator, images whose lifetimes (first to last
+//     live pass) don't overlap share the same allocation.
+//   - Graphics passes get a VkRenderPass and framebuffers. Attachments are already in the right
+//     layout when the render pass begins, so the render passes don't transition anything, and
+//     attachments nobody reads afterwards are not stored.
+//
+// The graph is rebuilt with the swapchain, everything it creates lives in the arena passed to
+// render_graph_begin. Buffers are only tracked for synchronization, their barriers are global
+// memory barriers so the graph doesn't need their handles.
+
+#define RENDER_GRAPH_MAX_PASSES 32
+#define RENDER_GRAPH_MAX_RESOURCES 32
+#define RENDER_GRAPH_MAX_USES 8
+
+typedef enum RenderGraphAccess {
+    RENDER_GRAPH_ACCESS_COLOR_ATTACHMENT,
+    RENDER_GRAPH_ACCESS_DEPTH_ATTACHMENT,
+    RENDER_GRAPH_ACCESS_DEPTH_READ,
+    RENDER_GRAPH_ACCESS_SAMPLED,
+    RENDER_GRAPH_ACCESS_STORAGE_READ,
+    RENDER_GRAPH_ACCESS_STORAGE_WRITE,
+    RENDER_GRAPH_ACCESS_INDIRECT_READ,
+    RENDER_GRAPH_ACCESS_VERTEX_READ,
+    RENDER_GRAPH_ACCESS_TRANSFER_SRC,
+    RENDER_GRAPH_ACCESS_TRANSFER_DST,
+    RENDER_GRAPH_ACCESS_COUNT,
+} RenderGraphAccess;
+
+typedef struct RenderGraphAccessInfo {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    VkImageUsageFlags usage;
+    bool write;
+    bool attachment;
+} RenderGraphAccessInfo;
+
+static const RenderGraphAccessInfo render_graph_access_infos[RENDER_GRAPH_ACCESS_COUNT] = {
+    [RENDER_GRAPH_ACCESS_COLOR_ATTACHMENT] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true, true },
+    [RENDER_GRAPH_ACCESS_DEPTH_ATTACHMENT] = {
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true, true },
+    [RENDER_GRAPH_ACCESS_DEPTH_READ] = {
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false, true },
+    [RENDER_GRAPH_ACCESS_SAMPLED] = {
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false, false },
+    [RENDER_GRAPH_ACCESS_STORAGE_READ] = {
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, false, false },
+    [RENDER_GRAPH_ACCESS_STORAGE_WRITE] = {
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+        VK_IMAGE_USAGE_STORAGE_BIT, true, false },
+    [RENDER_GRAPH_ACCESS_INDIRECT_READ] = {
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false, false },
+    [RENDER_GRAPH_ACCESS_VERTEX_READ] = {
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false, false },
+    [RENDER_GRAPH_ACCESS_TRANSFER_SRC] = {
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, false },
+    [RENDER_GRAPH_ACCESS_TRANSFER_DST] = {
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true, false },
+};
+
+typedef enum RenderGraphPassType {
+    RENDER_GRAPH_PASS_GRAPHICS,
+    RENDER_GRAPH_PASS_COMPUTE,
+    RENDER_GRAPH_PASS_TRANSFER,
+} RenderGraphPassType;
+
+typedef struct RenderGraph RenderGraph;
+
+// NOTE: Records the commands of a pass, graphics passes are called inside their render pass.
+typedef void RenderGraphExecute(RenderGraph *graph, VkCommandBuffer command_buffer, void *user,
+                                unsigned int frame);
+
+// NOTE: Where a resource was last touched, used to build the barrier of its next use. The stages
+// in read_stages have already seen the last write with the accesses in read_access.
+typedef struct RenderGraphState {
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    VkPipelineStageFlags read_stages;
+    VkAccessFlags read_access;
+    VkImageLayout layout;
+} RenderGraphState;
+
+typedef struct RenderGraphResource {
+    const char *name;
+    bool is_image;
+    bool imported;
+
+    // NOTE: Imported images can have one image per swapchain image, picked with image_index.
+    VkImage *images;
+    VkImageView *views;
+    unsigned int images_count;
+    VkImageLayout final_layout;
+    RenderGraphState initial_state;
+
+    // NOTE: Transient images, the usage is collected from the passes that use them.
+    VkFormat format;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect;
+    VkImage image;
+    VkImageView view;
+    VkMemoryRequirements memory_requirements;
+    unsigned int memory_slot;
+
+    bool needed;
+    int first_pass;
+    int last_pass;
+    VkPipelineStageFlags last_stages;
+    VkAccessFlags last_write_access;
+} RenderGraphResource;
+
+typedef struct RenderGraphUse {
+    unsigned int resource;
+    RenderGraphAccess access;
+    VkAttachmentLoadOp load_op;
+    VkClearValue clear;
+} RenderGraphUse;
+
+typedef struct RenderGraphBarrier {
+    unsigned int resource;
+    VkPipelineStageFlags src_stages;
+    VkAccessFlags src_access;
+    VkPipelineStageFlags dst_stages;
+    VkAccessFlags dst_access;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+} RenderGraphBarrier;
+
+typedef struct RenderGraphPass {
+    const char *name;
+    RenderGraphPassType type;
+    RenderGraphExecute *execute;
+    void *user;
+
+    RenderGraphUse uses[RENDER_GRAPH_MAX_USES];
+    unsigned int uses_count;
+    bool culled;
+
+    RenderGraphBarrier barriers[RENDER_GRAPH_MAX_USES];
+    unsigned int barriers_count;
+
+    // NOTE: SECONDARY_COMMAND_BUFFERS for passes recorded by other threads.
+    VkSubpassContents contents;
+    VkRenderPass render_pass;
+    VkFramebuffer *framebuffers;
+    unsigned int framebuffers_count;
+    VkClearValue clears[RENDER_GRAPH_MAX_USES];
+    unsigned int attachments_count;
+} RenderGraphPass;
+
+typedef struct RenderGraphMemorySlot {
+    VkMemoryRequirements requirements;
+    GpuAllocation memory;
+} RenderGraphMemorySlot;
+
+struct RenderGraph {
+    Arena *arena;
+    VkDevice device;
+    GpuAllocator *allocator;
+    VkExtent2D extent;
+
+    // NOTE: Swapchain image of the frame being executed.
+    uint32_t image_index;
+
+    RenderGraphResource resources[RENDER_GRAPH_MAX_RESOURCES];
+    unsigned int resources_count;
+    RenderGraphPass passes[RENDER_GRAPH_MAX_PASSES];
+    unsigned int passes_count;
+
+    RenderGraphMemorySlot memory_slots[RENDER_GRAPH_MAX_RESOURCES];
+    unsigned int memory_slots_count;
+
+    // NOTE: Transitions of the imported images to their final layout after the last pass.
+    RenderGraphBarrier final_barriers[RENDER_GRAPH_MAX_RESOURCES];
+    unsigned int final_barriers_count;
+
+    unsigned int culled_count;
+    unsigned int barrier_batches_count;
+    unsigned int barriers_count;
+    VkDeviceSize transient_bytes;
+    VkDeviceSize transient_bytes_unaliased;
+};
+
+void render_graph_begin(RenderGraph *graph, Arena *arena, VkDevice device, GpuAllocator *allocator,
+                        VkExtent2D extent) {
+    memset(graph, 0, sizeof(*graph));
+    graph->arena     = arena;
+    graph->device    = device;
+    graph->allocator = allocator;
+    graph->extent    = extent;
+}
+
+static unsigned int render_graph_push_resource(RenderGraph *graph, const char *name) {
+    if(graph->resources_count == RENDER_GRAPH_MAX_RESOURCES) {
+        printf("Too many render graph resources!\n");
+        exit(1);
+    }
+    unsigned int index             = graph->resources_count++;
+    RenderGraphResource *resource  = &graph->resources[index];
+    resource->name                 = name;
+    resource->first_pass           = -1;
+    resource->last_pass            = -1;
+    resource->initial_state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    return index;
+}
+
+// NOTE: ready_stages is the stage the image can be used from when the frame starts, e.g. the wait
+// stage of the acquire semaphore for swapchain images. A final layout other than UNDEFINED makes
+// the image an output of the graph, the passes that contribute to it are never culled.
+unsigned int render_graph_import_image(RenderGraph *graph, const char *name, VkImage *images,
+                                       VkImageView *views, unsigned int images_count,
+                                       VkFormat format, VkPipelineStageFlags ready_stages,
+                                       VkImageLayout final_layout) {
+    unsigned int index                   = render_graph_push_resource(graph, name);
+    RenderGraphResource *resource        = &graph->resources[index];
+    resource->is_image                   = true;
+    resource->imported                   = true;
+    resource->images                     = images;
+    resource->views                      = views;
+    resource->images_count               = images_count;
+    resource->format                     = format;
+    resource->aspect                     = VK_IMAGE_ASPECT_COLOR_BIT;
+    resource->final_layout               = final_layout;
+    resource->initial_state.write_stages = ready_stages;
+    return index;
+}
+
+unsigned int render_graph_import_buffer(RenderGraph *graph, const char *name) {
+    unsigned int index               = render_graph_push_resource(graph, name);
+    graph->resources[index].imported = true;
+    return index;
+}
+
+// NOTE: A transient image the size of the graph, its contents don't survive the frame.
+unsigned int render_graph_create_image(RenderGraph *graph, const char *name, VkFormat format,
+                                       VkImageAspectFlags aspect) {
+    unsigned int index            = render_graph_push_resource(graph, name);
+    RenderGraphResource *resource = &graph->resources[index];
+    resource->is_image            = true;
+    resource->format              = format;
+    resource->aspect              = aspect;
+    return index;
+}
+
+unsigned int render_graph_add_pass(RenderGraph *graph, const char *name, RenderGraphPassType type,
+                                   RenderGraphExecute *execute, void *user) {
+    if(graph->passes_count == RENDER_GRAPH_MAX_PASSES) {
+        printf("Too many render graph passes!\n");
+        exit(1);
+    }
+    unsigned int index    = graph->passes_count++;
+    RenderGraphPass *pass = &graph->passes[index];
+    pass->name            = name;
+    pass->type            = type;
+    pass->execute         = execute;
+    pass->user            = user;
+    pass->contents        = VK_SUBPASS_CONTENTS_INLINE;
+    return index;
+}
+
+static RenderGraphUse *render_graph_push_use(RenderGraph *graph, unsigned int pass_index,
+                                             unsigned int resource, RenderGraphAccess access) {
+    RenderGraphPass *pass = &graph->passes[pass_index];
+    if(pass->uses_count == RENDER_GRAPH_MAX_USES) {
+        printf("Too many resources used by render graph pass %s!\n", pass->name);
+        exit(1);
+    }
+    RenderGraphUse *use = &pass->uses[pass->uses_count++];
+    memset(use, 0, sizeof(*use));
+    use->resource = resource;
+    use->access   = access;
+    use->load_op  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    return use;
+}
+
+// NOTE: The previous contents are kept, except for transfer writes which overwrite the whole
+// image. Use render_graph_use_attachment to clear or discard an attachment instead.
+void render_graph_use(RenderGraph *graph, unsigned int pass, unsigned int resource,
+                      RenderGraphAccess access) {
+    RenderGraphUse *use = render_graph_push_use(graph, pass, resource, access);
+    if(access != RENDER_GRAPH_ACCESS_TRANSFER_DST) {
+        use->load_op = VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
+}
+
+// NOTE: The pass records its commands into secondary command buffers and executes them with
+// vkCmdExecuteCommands, nothing else can be recorded inline in its render pass.
+void render_graph_set_secondary(RenderGraph *graph, unsigned int pass) {
+    assert(graph->passes[pass].type == RENDER_GRAPH_PASS_GRAPHICS);
+    graph->passes[pass].contents = VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
+}
+
+// NOTE: A color or depth attachment, load_op LOAD makes the pass read the previous contents.
+void render_graph_use_attachment(RenderGraph *graph, unsigned int pass, unsigned int resource,
+                                 RenderGraphAccess access, VkAttachmentLoadOp load_op,
+                                 VkClearValue clear) {
+    assert(render_graph_access_infos[access].attachment);
+    RenderGraphUse *use = render_graph_push_use(graph, pass, resource, access);
+    use->load_op        = load_op;
+    use->clear          = clear;
+}
+
+static inline bool render_graph_use_reads(RenderGraphUse *use) {
+    return use->load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+}
+
+static inline VkAccessFlags render_graph_use_access(RenderGraphUse *use) {
+    VkAccessFlags access = render_graph_access_infos[use->access].access;
+    if(use->access == RENDER_GRAPH_ACCESS_COLOR_ATTACHMENT &&
+       use->load_op == VK_ATTACHMENT_LOAD_OP_LOAD) {
+        access |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+    }
+    return access;
+}
+
+// NOTE: Walk the passes backwards, a pass is live when it writes something that is needed and
+// then everything it reads is needed too.
+static void render_graph_cull(RenderGraph *graph) {
+    for(unsigned int i = 0; i < graph->resources_count; ++i) {
+        RenderGraphResource *resource = &graph->resources[i];
+        resource->needed              = resource->final_layout != VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+    for(int pass_index = (int)graph->passes_count - 1; pass_index >= 0; --pass_index) {
+        RenderGraphPass *pass = &graph->passes[pass_index];
+        pass->culled          = true;
+        for(unsigned int i = 0; i < pass->uses_count; ++i) {
+            RenderGraphUse *use = &pass->uses[i];
+            if(render_graph_access_infos[use->access].write &&
+               graph->resources[use->resource].needed) {
+                pass->culled = false;
+            }
+        }
+        if(pass->culled) {
+            ++graph->culled_count;
+            continue;
+        }
+        for(unsigned int i = 0; i < pass->uses_count; ++i) {
+            RenderGraphUse *use = &pass->uses[i];
+            if(render_graph_use_reads(use)) {
+                graph->resources[use->resource].needed = true;
+            }
+        }
+    }
+}
+
+static void render_graph_compute_lifetimes(RenderGraph *graph) {
+    for(unsigned int pass_index = 0; pass_index < graph->passes_count; ++pass_index) {
+        RenderGraphPass *pass = &graph->passes[pass_index];
+        if(pass->culled) {
+            continue;
+        }
+        for(unsigned int i = 0; i < pass->uses_count; ++i) {
+            RenderGraphUse *use                = &pass->uses[i];
+            const RenderGraphAccessInfo *info  = &render_graph_access_infos[use->access];
+            RenderGraphResource *resource      = &graph->resources[use->resource];
+            if(resource->first_pass < 0) {
+                resource->first_pass = (int)pass_index;
+            }
+            if(resource->last_pass != (int)pass_index) {
+                resource->last_stages       = 0;
+                resource->last_write_access = 0;
+            }
+            resource->last_pass = (int)pass_index;
+            resource->last_stages |= info->stage;
+            if(info->write) {
+                resource->last_write_access |= render_graph_use_access(use);
+            }
+            resource->usage |= info->usage;
+        }
+    }
+}
+
+static inline bool render_graph_lifetimes_overlap(RenderGraphResource *a, RenderGraphResource *b) {
+    return a->first_pass <= b->last_pass && b->first_pass <= a->last_pass;
+}
+
+// NOTE: Greedy first fit, biggest images first. An image can go in a slot when its lifetime
+// doesn't overlap with any image already in it and the memory types are compatible.
+static void render_graph_alias_transients(RenderGraph *graph) {
+    unsigned int order[RENDER_GRAPH_MAX_RESOURCES];
+    unsigned int order_count = 0;
+    for(unsigned int i = 0; i < graph->resources_count; ++i) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if(!resource->is_image || resource->imported || resource->first_pass < 0) {
+            continue;
+        }
+
+        VkImageCreateInfo image_info = { 0 };
+        image_info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType         = VK_IMAGE_TYPE_2D;
+        image_info.format            = resource->format;
+        image_info.extent.width      = graph->extent.width;
+        image_info.extent.height     = graph->extent.height;
+        image_info.extent.depth      = 1;
+        image_info.mipLevels         = 1;
+        image_info.arrayLayers       = 1;
+        image_info.samples           = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling            = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage             = resource->usage;
+        image_info.sharingMode       = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+        if(vkCreateImage(graph->device, &image_info, NULL, &resource->image) != VK_SUCCESS) {
+            printf("Failed to create render graph image %s!\n", resource->name);
+            exit(1);
+        }
+        vkGetImageMemoryRequirements(graph->device, resource->image,
+                                     &resource->memory_requirements);
+        graph->transient_bytes_unaliased += resource->memory_requirements.size;
+
+        unsigned int slot = order_count++;
+        while(slot > 0 && graph->resources[order[slot - 1]].memory_requirements.size <
+                              resource->memory_requirements.size) {
+            order[slot] = order[slot - 1];
+            --slot;
+        }
+        order[slot] = i;
+    }
+
+    for(unsigned int i = 0; i < order_count; ++i) {
+        RenderGraphResource *resource     = &graph->resources[order[i]];
+        VkMemoryRequirements *requirements = &resource->memory_requirements;
+
+        unsigned int slot_index = graph->memory_slots_count;
+        for(unsigned int slot = 0; slot < graph->memory_slots_count; ++slot) {
+            if((graph->memory_slots[slot].requirements.memoryTypeBits &
+                requirements->memoryTypeBits) == 0) {
+                continue;
+            }
+            bool fits = true;
+            for(unsigned int j = 0; j < i; ++j) {
+                RenderGraphResource *other = &graph->resources[order[j]];
+                if(other->memory_slot == slot && render_graph_lifetimes_overlap(resource, other)) {
+                    fits = false;
+                    break;
+                }
+            }
+            if(fits) {
+                slot_index = slot;
+                break;
+            }
+        }
+
+        RenderGraphMemorySlot *slot = &graph->memory_slots[slot_index];
+        if(slot_index == graph->memory_slots_count) {
+            ++graph->memory_slots_count;
+            slot->requirements = *requirements;
+        } else {
+            slot->requirements.size = max(slot->requirements.size, requirements->size);
+            slot->requirements.alignment =
+                max(slot->requirements.alignment, requirements->alignment);
+            slot->requirements.memoryTypeBits &= requirements->memoryTypeBits;
+        }
+        resource->memory_slot = slot_index;
+    }
+
+    for(unsigned int slot_index = 0; slot_index < graph->memory_slots_count; ++slot_index) {
+        RenderGraphMemorySlot *slot = &graph->memory_slots[slot_index];
+        slot->memory = gpu_alloc(graph->allocator, &slot->requirements,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        graph->transient_bytes += slot->requirements.size;
+    }
+
+    for(unsigned int i = 0; i < order_count; ++i) {
+        RenderGraphResource *resource = &graph->resources[order[i]];
+        RenderGraphMemorySlot *slot   = &graph->memory_slots[resource->memory_slot];
+        vkBindImageMemory(graph->device, resource->image, slot->memory.memory,
+                          slot->memory.offset);
+
+        VkImageViewCreateInfo view_info           = { 0 };
+        view_info.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image                           = resource->image;
+        view_info.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format                          = resource->format;
+        view_info.subresourceRange.aspectMask     = resource->aspect;
+        view_info.subresourceRange.baseMipLevel   = 0;
+        view_info.subresourceRange.levelCount     = 1;
+        view_info.subresourceRange.baseArrayLayer = 0;
+        view_info.subresourceRange.layerCount     = 1;
+        if(vkCreateImageView(graph->device, &view_info, NULL, &resource->view) != VK_SUCCESS) {
+            printf("Failed to create render graph image view %s!\n", resource->name);
+            exit(1);
+        }
+        resource->images       = &resource->image;
+        resource->views        = &resource->view;
+        resource->images_count = 1;
+    }
+
+    // NOTE: The contents of a transient are discarded at its first use. Before that use it has to
+    // wait for the image that used the memory before it: the previous one in the slot, or for
+    // the first one the last one of the previous frame, which for a slot of one is itself.
+    for(unsigned int i = 0; i < order_count; ++i) {
+        RenderGraphResource *resource = &graph->resources[order[i]];
+        RenderGraphResource *previous = NULL;
+        RenderGraphResource *last     = resource;
+        for(unsigned int j = 0; j < order_count; ++j) {
+            RenderGraphResource *other = &graph->resources[order[j]];
+            if(other->memory_slot != resource->memory_slot) {
+                continue;
+            }
+            if(other->last_pass < resource->first_pass &&
+               (previous == NULL || other->last_pass > previous->last_pass)) {
+                previous = other;
+            }
+            if(other->last_pass > last->last_pass) {
+                last = other;
+            }
+        }
+        if(previous == NULL) {
+            previous = last;
+        }
+        resource->initial_state.write_stages = previous->last_stages;
+        resource->initial_state.write_access = previous->last_write_access;
+    }
+}
+
+static void render_graph_compute_barriers(RenderGraph *graph) {
+    RenderGraphState states[RENDER_GRAPH_MAX_RESOURCES];
+    for(unsigned int i = 0; i < graph->resources_count; ++i) {
+        states[i] = graph->resources[i].initial_state;
+    }
+
+    for(unsigned int pass_index = 0; pass_index < graph->passes_count; ++pass_index) {
+        RenderGraphPass *pass = &graph->passes[pass_index];
+        if(pass->culled) {
+            continue;
+        }
+        for(unsigned int i = 0; i < pass->uses_count; ++i) {
+            RenderGraphUse *use               = &pass->uses[i];
+            const RenderGraphAccessInfo *info = &render_graph_access_infos[use->access];
+            RenderGraphResource *resource     = &graph->resources[use->resource];
+            RenderGraphState *state           = &states[use->resource];
+            VkAccessFlags access              = render_graph_use_access(use);
+            VkImageLayout layout = resource->is_image ? info->layout : VK_IMAGE_LAYOUT_UNDEFINED;
+
+            // NOTE: Layout changes and writes wait for every earlier access (write after read
+            // only needs the execution dependency), reads only wait for a write they haven't
+            // seen yet.
+            bool transition = layout != state->layout;
+            RenderGraphBarrier barrier = { 0 };
+            barrier.resource           = use->resource;
+            barrier.dst_stages         = info->stage;
+            barrier.dst_access         = access;
+            barrier.old_layout         = state->layout;
+            barrier.new_layout         = layout;
+            bool needed                = false;
+            if(transition || info->write) {
+                barrier.src_stages = state->write_stages | state->read_stages;
+                barrier.src_access = state->write_access;
+                needed             = transition || barrier.src_stages != 0;
+            } else if(state->write_stages != 0 && ((info->stage & ~state->read_stages) != 0 ||
+                                                   (access & ~state->read_access) != 0)) {
+                barrier.src_stages = state->write_stages;
+                barrier.src_access = state->write_access;
+                needed             = true;
+            }
+
+            // NOTE: A transition writes the image too, later readers chain on its stage.
+            if(info->write || transition) {
+                state->write_stages = info->stage;
+                state->write_access = info->write ? access : 0;
+                state->read_stages  = info->write ? 0 : info->stage;
+                state->read_access  = info->write ? 0 : access;
+                state->layout       = layout;
+            } else {
+                state->read_stages |= info->stage;
+                state->read_access |= access;
+            }
+
+            if(needed) {
+                if(barrier.src_stages == 0) {
+                    barrier.src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                }
+                // NOTE: Nothing to keep when the pass overwrites the whole image.
+                if(!render_graph_use_reads(use)) {
+                    barrier.old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                }
+                pass->barriers[pass->barriers_count++] = barrier;
+                ++graph->barriers_count;
+            }
+        }
+        if(pass->barriers_count > 0) {
+            ++graph->barrier_batches_count;
+        }
+    }
+
+    for(unsigned int i = 0; i < graph->resources_count; ++i) {
+        RenderGraphResource *resource = &graph->resources[i];
+        RenderGraphState *state       = &states[i];
+        if(resource->final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+           resource->final_layout == state->layout) {
+            continue;
+        }
+        RenderGraphBarrier *barrier = &graph->final_barriers[graph->final_barriers_count++];
+        barrier->resource           = i;
+        barrier->src_stages         = state->write_stages | state->read_stages;
+        barrier->src_access         = state->write_access;
+        barrier->dst_stages         = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        barrier->dst_access         = 0;
+        barrier->old_layout         = state->layout;
+        barrier->new_layout         = resource->final_layout;
+        ++graph->barriers_count;
+    }
+    if(graph->final_barriers_count > 0) {
+        ++graph->barrier_batches_count;
+    }
+}
+
+// NOTE: An attachment only has to be stored when it leaves the graph or a later pass reads it.
+static bool render_graph_read_after(RenderGraph *graph, unsigned int resource,
+                                    unsigned int pass_index) {
+    if(graph->resources[resource].imported) {
+        return true;
+    }
+    for(unsigned int later = pass_index + 1; later < graph->passes_count; ++later) {
+        RenderGraphPass *pass = &graph->passes[later];
+        for(unsigned int i = 0; !pass->culled && i < pass->uses_count; ++i) {
+            if(pass->uses[i].resource == resource) {
+                return render_graph_use_reads(&pass->uses[i]);
+            }
+        }
+    }
+    return false;
+}
+
+static void render_graph_create_render_pass(RenderGraph *graph, unsigned int pass_index) {
+    RenderGraphPass *pass = &graph->passes[pass_index];
+    VkAttachmentDescription attachments[RENDER_GRAPH_MAX_USES];
+    VkAttachmentReference color_refs[RENDER_GRAPH_MAX_USES];
+    VkAttachmentReference depth_ref = { 0 };
+    unsigned int color_count        = 0;
+    bool has_depth                  = false;
+    unsigned int framebuffers_count = 1;
+
+    pass->attachments_count = 0;
+    for(unsigned int i = 0; i < pass->uses_count; ++i) {
+        RenderGraphUse *use               = &pass->uses[i];
+        const RenderGraphAccessInfo *info = &render_graph_access_infos[use->access];
+        RenderGraphResource *resource     = &graph->resources[use->resource];
+        if(!info->attachment) {
+            continue;
+        }
+
+        unsigned int index                 = pass->attachments_count++;
+        VkAttachmentDescription *attachment = &attachments[index];
+        memset(attachment, 0, sizeof(*attachment));
+        attachment->format         = resource->format;
+        attachment->samples        = VK_SAMPLE_COUNT_1_BIT;
+        attachment->loadOp         = use->load_op;
+        attachment->storeOp        = render_graph_read_after(graph, use->resource, pass_index)
+                                             ? VK_ATTACHMENT_STORE_OP_STORE
+                                             : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment->stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment->initialLayout  = info->layout;
+        attachment->finalLayout    = info->layout;
+        pass->clears[index] = use->clear;
+
+        if(use->access == RENDER_GRAPH_ACCESS_COLOR_ATTACHMENT) {
+            color_refs[color_count].attachment = index;
+            color_refs[color_count].layout     = info->layout;
+            ++color_count;
+        } else {
+            depth_ref.attachment = index;
+            depth_ref.layout     = info->layout;
+            has_depth            = true;
+        }
+        framebuffers_count = max(framebuffers_count, resource->images_count);
+    }
+
+    VkSubpassDescription subpass    = { 0 };
+    subpass.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount    = color_count;
+    subpass.pColorAttachments       = color_refs;
+    subpass.pDepthStencilAttachment = has_depth ? &depth_ref : NULL;
+
+    // NOTE: No dependencies, the barriers recorded before the render pass already cover it.
+    VkRenderPassCreateInfo render_pass_info = { 0 };
+    render_pass_info.sType                  = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount        = pass->attachments_count;
+    render_pass_info.pAttachments           = attachments;
+    render_pass_info.subpassCount           = 1;
+    render_pass_info.pSubpasses             = &subpass;
+
+    if(vkCreateRenderPass(graph->device, &render_pass_info, NULL, &pass->render_pass) !=
+       VK_SUCCESS) {
+        printf("Failed to create render pass %s!\n", pass->name);
+        exit(1);
+    }
+
+    pass->framebuffers_count = framebuffers_count;
+    pass->framebuffers = arena_push_array(graph->arena, VkFramebuffer, framebuffers_count);
+    for(unsigned int fb = 0; fb < framebuffers_count; ++fb) {
+        VkImageView views[RENDER_GRAPH_MAX_USES];
+        unsigned int views_count = 0;
+        for(unsigned int i = 0; i < pass->uses_count; ++i) {
+            RenderGraphUse *use           = &pass->uses[i];
+            RenderGraphResource *resource = &graph->resources[use->resource];
+            if(render_graph_access_infos[use->access].attachment) {
+                views[views_count++] = resource->views[fb % resource->images_count];
+            }
+        }
+
+        VkFramebufferCreateInfo framebuffer_info = { 0 };
+        framebuffer_info.sType                   = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebuffer_info.renderPass              = pass->render_pass;
+        framebuffer_info.attachmentCount         = views_count;
+        framebuffer_info.pAttachments            = views;
+        framebuffer_info.width                   = graph->extent.width;
+        framebuffer_info.height                  = graph->extent.height;
+        framebuffer_info.layers                  = 1;
+        if(vkCreateFramebuffer(graph->device, &framebuffer_info, NULL, &pass->framebuffers[fb]) !=
+           VK_SUCCESS) {
+            printf("Failed to create framebuffer!\n");
+            exit(1);
+        }
+    }
+}
+
+void render_graph_compile(RenderGraph *graph) {
+    render_graph_cull(graph);
+    render_graph_compute_lifetimes(graph);
+    render_graph_alias_transients(graph);
+    render_graph_compute_barriers(graph);
+    for(unsigned int pass_index = 0; pass_index < graph->passes_count; ++pass_index) {
+        RenderGraphPass *pass = &graph->passes[pass_index];
+        if(!pass->culled && pass->type == RENDER_GRAPH_PASS_GRAPHICS) {
+            render_graph_create_render_pass(graph, pass_index);
+        }
+    }
+}
+
+static void render_graph_record_barriers(RenderGraph *graph, VkCommandBuffer command_buffer,
+                                         RenderGraphBarrier *barriers, unsigned int count,
+                                         uint32_t image_index) {
+    if(count == 0) {
+        return;
+    }
+
+    VkImageMemoryBarrier image_barriers[RENDER_GRAPH_MAX_RESOURCES];
+    unsigned int image_barriers_count = 0;
+    VkMemoryBarrier memory_barrier    = { 0 };
+    memory_barrier.sType              = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    bool has_memory_barrier           = false;
+    VkPipelineStageFlags src_stages   = 0;
+    VkPipelineStageFlags dst_stages   = 0;
+
+    for(unsigned int i = 0; i < count; ++i) {
+        RenderGraphBarrier *barrier   = &barriers[i];
+        RenderGraphResource *resource = &graph->resources[barrier->resource];
+        src_stages |= barrier->src_stages;
+        dst_stages |= barrier->dst_stages;
+        if(!resource->is_image) {
+            memory_barrier.srcAccessMask |= barrier->src_access;
+            memory_barrier.dstAccessMask |= barrier->dst_access;
+            has_memory_barrier = true;
+            continue;
+        }
+
+        VkImageMemoryBarrier *image_barrier = &image_barriers[image_barriers_count++];
+        memset(image_barrier, 0, sizeof(*image_barrier));
+        image_barrier->sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier->srcAccessMask       = barrier->src_access;
+        image_barrier->dstAccessMask       = barrier->dst_access;
+        image_barrier->oldLayout           = barrier->old_layout;
+        image_barrier->newLayout           = barrier->new_layout;
+        image_barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier->image = resource->images[image_index % resource->images_count];
+        image_barrier->subresourceRange.aspectMask     = resource->aspect;
+        image_barrier->subresourceRange.baseMipLevel   = 0;
+        image_barrier->subresourceRange.levelCount     = 1;
+        image_barrier->subresourceRange.baseArrayLayer = 0;
+        image_barrier->subresourceRange.layerCount     = 1;
+    }
+
+    vkCmdPipelineBarrier(command_buffer, src_stages, dst_stages, 0, has_memory_barrier ? 1 : 0,
+                         &memory_barrier, 0, NULL, image_barriers_count, image_barriers);
+}
+
+void render_graph_execute(RenderGraph *graph, VkCommandBuffer command_buffer, uint32_t image_index,
+                          unsigned int frame) {
+    graph->image_index = image_index;
+    for(unsigned int pass_index = 0; pass_index < graph->passes_count; ++pass_index) {
+        RenderGraphPass *pass = &graph->passes[pass_index];
+        if(pass->culled) {
+            continue;
+        }
+        render_graph_record_barriers(graph, command_buffer, pass->barriers, pass->barriers_count,
+                                     image_index);
+
+        if(pass->type == RENDER_GRAPH_PASS_GRAPHICS) {
+            VkRenderPassBeginInfo render_pass_info = { 0 };
+            render_pass_info.sType                 = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            render_pass_info.renderPass            = pass->render_pass;
+            render_pass_info.framebuffer =
+                pass->framebuffers[image_index % pass->framebuffers_count];
+            render_pass_info.renderArea.offset = (VkOffset2D){ 0, 0 };
+            render_pass_info.renderArea.extent = graph->extent;
+            render_pass_info.clearValueCount   = pass->attachments_count;
+            render_pass_info.pClearValues      = pass->clears;
+            vkCmdBeginRenderPass(command_buffer, &render_pass_info, pass->contents);
+            pass->execute(graph, command_buffer, pass->user, frame);
+            vkCmdEndRenderPass(command_buffer);
+        } else {
+            pass->execute(graph, command_buffer, pass->user, frame);
+        }
+    }
+    render_graph_record_barriers(graph, command_buffer, graph->final_barriers,
+                                 graph->final_barriers_count, image_index);
+}
+
+VkRenderPass render_graph_get_render_pass(RenderGraph *graph, unsigned int pass) {
+    return graph->passes[pass].render_pass;
+}
+
+// NOTE: The framebuffer of a graphics pass in the frame being executed.
+VkFramebuffer render_graph_get_framebuffer(RenderGraph *graph, unsigned int pass) {
+    RenderGraphPass *graphics_pass = &graph->passes[pass];
+    return graphics_pass->framebuffers[graph->image_index % graphics_pass->framebuffers_count];
+}
+
+// NOTE: The image of a resource in the frame being executed.
+VkImage render_graph_get_image(RenderGraph *graph, unsigned int resource) {
+    RenderGraphResource *image = &graph->resources[resource];
+    return image->images[graph->image_index % image->images_count];
+}
+
+// NOTE: The device must be idle, or at least done with every frame that used the graph.
+void render_graph_destroy(RenderGraph *graph) {
+    for(unsigned int pass_index = 0; pass_index < graph->passes_count; ++pass_index) {
+        RenderGraphPass *pass = &graph->passes[pass_index];
+        for(unsigned int fb = 0; fb < pass->framebuffers_count; ++fb) {
+            vkDestroyFramebuffer(graph->device, pass->framebuffers[fb], NULL);
+        }
+        vkDestroyRenderPass(graph->device, pass->render_pass, NULL);
+    }
+    for(unsigned int i = 0; i < graph->resources_count; ++i) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if(!resource->imported) {
+            vkDestroyImageView(graph->device, resource->view, NULL);
+            vkDestroyImage(graph->device, resource->image, NULL);
+        }
+    }
+    for(unsigned int slot = 0; slot < graph->memory_slots_count; ++slot) {
+        gpu_free(graph->allocator, &graph->memory_slots[slot].memory);
+    }
+    graph->passes_count       = 0;
+    graph->resources_count    = 0;
+    graph->memory_slots_count = 0;
+}
+
+void render_graph_print_stats(RenderGraph *graph) {
+    printf("render graph: %u passes (%u culled), %u barriers in %u batches per frame, "
+           "transients %.2f MB (%.2f MB without aliasing)\n",
+           graph->passes_count - graph->culled_count, graph->culled_count, graph->barriers_count,
+           graph->barrier_batches_count, (double)graph->transient_bytes / mb(1),
+           (double)graph->transient_bytes_unaliased / mb(1));
+}
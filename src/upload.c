@@ -0,0 +1,209 @@
+// NOTE: Staging ring buffer for uploads into DEVICE_LOCAL buffers. Data is copied into a
+// persistently mapped HOST_VISIBLE ring and the pending copies are recorded once per frame, grouped
+// by destination buffer. Space is handed back when the frame slot that submitted the copies comes
+// around again, which means its in flight fence has already been waited on.
+//
+// With a dedicated transfer queue the copies are recorded in a command buffer of that queue
+// instead. Buffers both queues touch are created concurrent so there is no ownership to hand over,
+// the semaphores order the queues: the transfer waits for the last frame that may still read one
+// of its destinations and the frame that consumes the data waits for the transfer. The frame only
+// completes after the transfer it waited for, so the ring space is still handed back with the
+// frame slot.
+
+#define UPLOAD_RING_SIZE mb(32)
+#define UPLOAD_RING_ALIGN 16
+#define UPLOAD_MAX_COPIES 1024
+// NOTE: Where uploaded data is consumed, the stages the barriers after the copies block.
+#define UPLOAD_DST_STAGES                                                                          \
+    (VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |                        \
+     VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+#define UPLOAD_DST_ACCESS                                                                          \
+    (VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |                              \
+     VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT)
+
+typedef struct UploadCopy {
+    VkBuffer dst;
+    VkBufferCopy region;
+} UploadCopy;
+
+typedef struct UploadStats {
+    double last_frame_mb;
+    double peak_frame_mb;
+    double avg_frame_mb;
+    double total_mb;
+} UploadStats;
+
+typedef struct UploadRing {
+    VkBuffer buffer;
+    GpuAllocation memory;
+    unsigned char *mapped;
+    VkDeviceSize size;
+
+    // NOTE: head and tail only grow, the ring offset is head % size.
+    VkDeviceSize head;
+    VkDeviceSize tail;
+    VkDeviceSize submitted_head;
+    VkDeviceSize frame_heads[MAX_FRAMES_IN_FLIGHT];
+
+    UploadCopy copies[UPLOAD_MAX_COPIES];
+    unsigned int copies_count;
+    // NOTE: The last frame that may still read a destination of the pending copies.
+    uint64_t read_frame;
+
+    VkDeviceSize frame_bytes;
+    VkDeviceSize total_bytes;
+    VkDeviceSize peak_frame_bytes;
+    VkDeviceSize last_frame_bytes;
+    unsigned long long frames_count;
+} UploadRing;
+
+void upload_ring_create(UploadRing *ring, VkDevice device, GpuAllocator *allocator,
+                        VkDeviceSize size) {
+    memset(ring, 0, sizeof(*ring));
+
+    VkBufferCreateInfo buffer_info = { 0 };
+    buffer_info.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size               = size;
+    buffer_info.usage              = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
+
+    if(vkCreateBuffer(device, &buffer_info, NULL, &ring->buffer) != VK_SUCCESS) {
+        printf("Failed to create upload ring buffer!\n");
+        exit(1);
+    }
+
+    VkMemoryRequirements mem_req;
+    vkGetBufferMemoryRequirements(device, ring->buffer, &mem_req);
+    ring->memory = gpu_alloc(allocator, &mem_req,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkBindBufferMemory(device, ring->buffer, ring->memory.memory, ring->memory.offset);
+
+    ring->mapped = (unsigned char *)ring->memory.mapped;
+    ring->size   = size;
+}
+
+void upload_ring_destroy(UploadRing *ring, VkDevice device, GpuAllocator *allocator) {
+    vkDestroyBuffer(device, ring->buffer, NULL);
+    gpu_free(allocator, &ring->memory);
+}
+
+// NOTE: Call after the in flight fence of the frame slot has been waited on.
+void upload_ring_begin_frame(UploadRing *ring, unsigned int frame) {
+    if(ring->frame_heads[frame] > ring->tail) {
+        ring->tail = ring->frame_heads[frame];
+    }
+}
+
+// NOTE: Call after every submitted frame has been waited on.
+void upload_ring_release_submitted(UploadRing *ring) {
+    ring->tail = ring->submitted_head;
+}
+
+// NOTE: read_frame is the last frame that may still read dst, 0 when no frame used it yet.
+bool upload_ring_push(UploadRing *ring, VkBuffer dst, VkDeviceSize dst_offset, const void *data,
+                      VkDeviceSize size, uint64_t read_frame) {
+    assert(size <= ring->size);
+    if(ring->copies_count == UPLOAD_MAX_COPIES) {
+        return false;
+    }
+
+    VkDeviceSize head   = gpu_align_up(ring->head, UPLOAD_RING_ALIGN);
+    VkDeviceSize offset = head % ring->size;
+    if(offset + size > ring->size) {
+        // NOTE: Don't split copies across the end of the ring, skip to the start instead.
+        head += ring->size - offset;
+        offset = 0;
+    }
+    if(head + size - ring->tail > ring->size) {
+        return false;
+    }
+
+    memcpy(ring->mapped + offset, data, size);
+
+    UploadCopy *copy       = &ring->copies[ring->copies_count++];
+    copy->dst              = dst;
+    copy->region.srcOffset = offset;
+    copy->region.dstOffset = dst_offset;
+    copy->region.size      = size;
+
+    ring->head       = head + size;
+    ring->read_frame = max(ring->read_frame, read_frame);
+    ring->frame_bytes += size;
+    return true;
+}
+
+// NOTE: Records the pending copies into command_buffer. On the graphics queue barriers order them
+// after the reads of earlier frames and before the reads of this one, on a transfer queue the
+// semaphores of its submit do that.
+void upload_ring_flush(UploadRing *ring, VkCommandBuffer command_buffer, unsigned int frame,
+                       bool transfer_queue) {
+    ring->frame_heads[frame] = ring->head;
+    ring->submitted_head     = ring->head;
+
+    ring->last_frame_bytes = ring->frame_bytes;
+    ring->total_bytes += ring->frame_bytes;
+    if(ring->frame_bytes > ring->peak_frame_bytes) {
+        ring->peak_frame_bytes = ring->frame_bytes;
+    }
+    ring->frame_bytes = 0;
+    ++ring->frames_count;
+
+    ring->read_frame = 0;
+    if(ring->copies_count == 0) {
+        return;
+    }
+
+    // NOTE: The previous frames' reads of the destinations only need to be done, nothing they
+    // wrote has to be made visible to the copies.
+    if(!transfer_queue) {
+        vkCmdPipelineBarrier(command_buffer, UPLOAD_DST_STAGES, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, NULL, 0, NULL, 0, NULL);
+    }
+
+    // NOTE: One vkCmdCopyBuffer per destination buffer with all of its regions batched together.
+    VkBufferCopy regions[UPLOAD_MAX_COPIES];
+    for(unsigned int first = 0; first < ring->copies_count; ++first) {
+        VkBuffer dst = ring->copies[first].dst;
+        if(dst == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        unsigned int regions_count = 0;
+        for(unsigned int copy_index = first; copy_index < ring->copies_count; ++copy_index) {
+            UploadCopy *copy = &ring->copies[copy_index];
+            if(copy->dst == dst) {
+                regions[regions_count++] = copy->region;
+                copy->dst                = VK_NULL_HANDLE;
+            }
+        }
+        vkCmdCopyBuffer(command_buffer, ring->buffer, dst, regions_count, regions);
+    }
+    ring->copies_count = 0;
+
+    if(!transfer_queue) {
+        VkMemoryBarrier barrier = { 0 };
+        barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask   = UPLOAD_DST_ACCESS;
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, UPLOAD_DST_STAGES, 0,
+                             1, &barrier, 0, NULL, 0, NULL);
+    }
+}
+
+UploadStats upload_ring_get_stats(UploadRing *ring) {
+    UploadStats stats   = { 0 };
+    stats.last_frame_mb = (double)ring->last_frame_bytes / mb(1);
+    stats.peak_frame_mb = (double)ring->peak_frame_bytes / mb(1);
+    stats.total_mb      = (double)ring->total_bytes / mb(1);
+    if(ring->frames_count > 0) {
+        stats.avg_frame_mb = stats.total_mb / (double)ring->frames_count;
+    }
+    return stats;
+}
+
+void upload_ring_print_stats(UploadRing *ring) {
+    UploadStats stats = upload_ring_get_stats(ring);
+    printf("uploads: %.3f MB last frame, %.3f MB/frame avg, %.3f MB peak frame, %.3f MB total\n",
+           stats.last_frame_mb, stats.avg_frame_mb, stats.peak_frame_mb, stats.total_mb);
+}